@@ -0,0 +1,431 @@
+#include "wadreader.h"
+
+// Times the codecs over lump classes, synthetic ones and the lumps of any
+// WADs given on the command line
+
+typedef enum
+{
+    CLASS_TEXTURE,
+    CLASS_SPRITE,
+    CLASS_MAP,
+    CLASS_DEMO,
+    CLASS_RANDOM,
+    CLASS_OTHER,
+    NUM_CLASSES
+} lumpclass;
+
+static const char* class_names[NUM_CLASSES] = { "texture", "sprite", "map", "demo", "random", "other" };
+
+typedef enum
+{
+    CODEC_D64,
+    CODEC_JAGUAR,
+    NUM_CODECS
+} benchcodec;
+
+static const char* codec_names[NUM_CODECS] = { "d64", "jaguar" };
+
+typedef struct
+{
+    std::vector<std::vector<byte>> lumps;
+    long long   bytes;
+} corpus_t;
+
+typedef struct
+{
+    long long   compressed_bytes;
+    double      encode_seconds;
+    double      decode_seconds;
+} codecresult_t;
+
+static unsigned int random_state = 1;
+
+static unsigned int next_random()
+{
+    random_state = random_state * 1103515245 + 12345;
+    return (random_state >> 16) & 0x7FFF;
+}
+
+// Smooth gradients with some noise, like a wall texture
+static std::vector<byte> make_texture(int width, int height)
+{
+    std::vector<byte> lump(width * height);
+
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            lump[y * width + x] = (byte) (((x + y) >> 2) + ((x ^ y) & 4) + (next_random() % 3));
+        }
+    }
+
+    return lump;
+}
+
+// Columns of opaque posts between runs of transparent zeros
+static std::vector<byte> make_sprite(int width, int height)
+{
+    std::vector<byte> lump(width * height);
+
+    for (int x = 0; x < width; ++x)
+    {
+        int top = (int) (next_random() % (height / 4));
+        int bottom = height - (int) (next_random() % (height / 4));
+        for (int y = top; y < bottom; ++y)
+        {
+            lump[y * width + x] = (byte) (0x40 + (y >> 3) + (next_random() & 1));
+        }
+    }
+
+    return lump;
+}
+
+// Records of small 16-bit coordinates and flags, like linedefs
+static std::vector<byte> make_map(int records)
+{
+    std::vector<byte> lump;
+    short x = 0;
+    short y = 0;
+
+    for (int i = 0; i < records; ++i)
+    {
+        x += (short) (next_random() % 64) - 32;
+        y += (short) (next_random() % 64) - 32;
+
+        short record[7] = { x, y, (short) (x + 64), y, (short) (next_random() & 0x21), 0, (short) i };
+        lump.insert(lump.end(), (byte*) record, (byte*) record + sizeof(record));
+    }
+
+    return lump;
+}
+
+// Tic commands that change every few tics
+static std::vector<byte> make_demo(int tics)
+{
+    std::vector<byte> lump;
+    byte command[4] = { 0, 0, 0, 0 };
+
+    for (int i = 0; i < tics; ++i)
+    {
+        if (next_random() % 6 == 0)
+        {
+            command[next_random() % 4] = (byte) next_random();
+        }
+        lump.insert(lump.end(), command, command + 4);
+    }
+
+    return lump;
+}
+
+static std::vector<byte> make_random(int size)
+{
+    std::vector<byte> lump(size);
+
+    for (int i = 0; i < size; ++i)
+    {
+        lump[i] = (byte) next_random();
+    }
+
+    return lump;
+}
+
+static void add_lump(corpus_t* corpus, std::vector<byte> lump)
+{
+    corpus->bytes += lump.size();
+    corpus->lumps.push_back(std::move(lump));
+}
+
+static void make_synthetic_corpora(corpus_t* corpora)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        add_lump(&corpora[CLASS_TEXTURE], make_texture(64, 64));
+        add_lump(&corpora[CLASS_SPRITE], make_sprite(48, 96));
+        add_lump(&corpora[CLASS_MAP], make_map(1500));
+        add_lump(&corpora[CLASS_DEMO], make_demo(4000));
+        add_lump(&corpora[CLASS_RANDOM], make_random(8192));
+    }
+}
+
+// Lumps are sorted by the markers they lie between, maps and demos by name.
+// Compressed lumps are taken as what they decompress to.
+static bool add_WAD_lumps(const char* file_name, corpus_t* corpora)
+{
+    mappedfile_t WAD;
+    if (!map_file(file_name, &WAD))
+    {
+        return false;
+    }
+
+    wadreader_t reader;
+    if (!wadreader_open(&reader, &WAD))
+    {
+        unmap_file(&WAD);
+        return false;
+    }
+
+    int region = CLASS_OTHER;
+    int skipped = 0;
+    std::vector<byte> data;
+    for (int i = 0; i < reader.header.numlumps; ++i)
+    {
+        std::string lump_name = lump_name_string(reader.lump_directory[i].name);
+
+        if (lump_name == "S_START")
+        {
+            region = CLASS_SPRITE;
+        }
+        else if (lump_name == "T_START")
+        {
+            region = CLASS_TEXTURE;
+        }
+        else if (lump_name == "S_END" || lump_name == "T_END")
+        {
+            region = CLASS_OTHER;
+        }
+
+        if (reader.lump_directory[i].size <= 0)
+        {
+            continue;
+        }
+
+        int source_size;
+        if (!wadreader_read(&reader, i, &data, &source_size))
+        {
+            skipped++;
+            continue;
+        }
+
+        int lump_class = region;
+        if (!lump_name.compare(0, 3, "MAP"))
+        {
+            lump_class = CLASS_MAP;
+        }
+        else if (!lump_name.compare(0, 4, "DEMO"))
+        {
+            lump_class = CLASS_DEMO;
+        }
+
+        add_lump(&corpora[lump_class], data);
+    }
+
+    if (skipped)
+    {
+        printf("%s: skipped %d lumps that lie outside the file or are corrupt\n", file_name, skipped);
+    }
+
+    wadreader_close(&reader);
+    unmap_file(&WAD);
+
+    return true;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Encodes and decodes every lump runs times, returns false if one doesn't come back the same
+static bool bench_codec(const corpus_t* corpus, int codec, int level, int runs, codecresult_t* result)
+{
+    std::vector<std::vector<byte>> compressed(corpus->lumps.size());
+    std::vector<int> compressed_sizes(corpus->lumps.size());
+    std::vector<byte> output;
+
+    result->compressed_bytes = 0;
+
+    // Room for what lumps that don't compress grow to, like the tool gives them
+    for (size_t i = 0; i < corpus->lumps.size(); ++i)
+    {
+        compressed[i].resize(corpus->lumps[i].size() + corpus->lumps[i].size() / 4 + 64);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; ++run)
+    {
+        for (size_t i = 0; i < corpus->lumps.size(); ++i)
+        {
+            const std::vector<byte>& lump = corpus->lumps[i];
+            if (codec == CODEC_D64)
+            {
+                compressed_sizes[i] = Deflate_Encode(lump.data(), (int) lump.size(), level,
+                    compressed[i].data(), (int) compressed[i].size());
+            }
+            else
+            {
+                compressed_sizes[i] = EncodeJaguar(lump.data(), (int) lump.size(), level,
+                    compressed[i].data(), (int) compressed[i].size());
+            }
+        }
+    }
+    result->encode_seconds = seconds_since(start);
+
+    // One that still doesn't fit fails the round trip below
+    for (size_t i = 0; i < compressed.size(); ++i)
+    {
+        compressed[i].resize(std::max(compressed_sizes[i], 0));
+    }
+
+    bool round_trip = true;
+    start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; ++run)
+    {
+        for (size_t i = 0; i < corpus->lumps.size(); ++i)
+        {
+            const std::vector<byte>& lump = corpus->lumps[i];
+            output.resize(lump.size());
+
+            bool decoded;
+            if (codec == CODEC_D64)
+            {
+                decoded = DecodeD64(compressed[i].data(), (int) compressed[i].size(), output.data(), (int) output.size());
+            }
+            else
+            {
+                decoded = DecodeJaguar(compressed[i].data(), (int) compressed[i].size(), output.data(), (int) output.size());
+            }
+
+            round_trip = round_trip && decoded && output == lump;
+        }
+    }
+    result->decode_seconds = seconds_since(start);
+
+    for (size_t i = 0; i < compressed.size(); ++i)
+    {
+        result->compressed_bytes += compressed[i].size();
+    }
+
+    return round_trip;
+}
+
+static double megabytes_per_second(long long bytes, int runs, double seconds)
+{
+    return (seconds > 0) ? (double) bytes * runs / seconds / 1e6 : 0;
+}
+
+static double nanoseconds_per_byte(long long bytes, int runs, double seconds)
+{
+    return (bytes > 0) ? seconds * 1e9 / ((double) bytes * runs) : 0;
+}
+
+static void bench_help()
+{
+    printf("USAGE: wadutil64_bench [--runs=N] [--level=fast|max] [--json=FILE] [WAD ...]\n");
+    printf("    Times both codecs over synthetic lumps and the lumps of the given WADs,\n");
+    printf("    --json=FILE also writes the results to FILE for tracking them across commits\n");
+}
+
+int main(int argc, char** argv)
+{
+    int runs = 3;
+    int level = ENCODE_FAST;
+    const char* json_file_name = NULL;
+
+    corpus_t corpora[NUM_CLASSES];
+    for (int i = 0; i < NUM_CLASSES; ++i)
+    {
+        corpora[i].bytes = 0;
+    }
+
+    make_synthetic_corpora(corpora);
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strncmp(argv[i], "--runs=", 7) && atoi(argv[i] + 7) > 0)
+        {
+            runs = atoi(argv[i] + 7);
+        }
+        else if (!strcmp(argv[i], "--level=fast"))
+        {
+            level = ENCODE_FAST;
+        }
+        else if (!strcmp(argv[i], "--level=max"))
+        {
+            level = ENCODE_MAX;
+        }
+        else if (!strncmp(argv[i], "--json=", 7) && argv[i][7])
+        {
+            json_file_name = argv[i] + 7;
+        }
+        else if (argv[i][0] == '-')
+        {
+            bench_help();
+            return EXIT_FAILURE;
+        }
+        else if (!add_WAD_lumps(argv[i], corpora))
+        {
+            printf("ERROR: Could not read WAD %s!\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    codecresult_t results[NUM_CLASSES][NUM_CODECS];
+    bool round_trip = true;
+
+    for (int i = 0; i < NUM_CLASSES; ++i)
+    {
+        for (int codec = 0; codec < NUM_CODECS; ++codec)
+        {
+            if (!bench_codec(&corpora[i], codec, level, runs, &results[i][codec]))
+            {
+                printf("ERROR: %s lumps don't decode back the same with %s!\n", class_names[i], codec_names[codec]);
+                round_trip = false;
+            }
+        }
+    }
+
+    printf("\n%-8s %-6s %5s %9s %7s %11s %9s %11s %9s\n", "class", "codec", "lumps", "bytes", "ratio",
+        "enc MB/s", "enc ns/B", "dec MB/s", "dec ns/B");
+
+    for (int i = 0; i < NUM_CLASSES; ++i)
+    {
+        for (int codec = 0; codec < NUM_CODECS && corpora[i].bytes; ++codec)
+        {
+            codecresult_t* result = &results[i][codec];
+            printf("%-8s %-6s %5zu %9lld %7.3f %11.2f %9.1f %11.2f %9.1f\n", class_names[i], codec_names[codec],
+                corpora[i].lumps.size(), corpora[i].bytes, (double) result->compressed_bytes / corpora[i].bytes,
+                megabytes_per_second(corpora[i].bytes, runs, result->encode_seconds),
+                nanoseconds_per_byte(corpora[i].bytes, runs, result->encode_seconds),
+                megabytes_per_second(corpora[i].bytes, runs, result->decode_seconds),
+                nanoseconds_per_byte(corpora[i].bytes, runs, result->decode_seconds));
+        }
+    }
+
+    if (json_file_name)
+    {
+        FILE* json = fopen(json_file_name, "w");
+        if (!json)
+        {
+            printf("ERROR: Could not write %s!\n", json_file_name);
+            return EXIT_FAILURE;
+        }
+
+        fprintf(json, "{\n  \"runs\": %d,\n  \"level\": \"%s\",\n  \"encoder_version\": %d,\n  \"results\": [",
+            runs, (level == ENCODE_MAX) ? "max" : "fast", ENCODER_VERSION);
+
+        bool first = true;
+        for (int i = 0; i < NUM_CLASSES; ++i)
+        {
+            for (int codec = 0; codec < NUM_CODECS && corpora[i].bytes; ++codec)
+            {
+                codecresult_t* result = &results[i][codec];
+                fprintf(json, "%s\n    { \"class\": \"%s\", \"codec\": \"%s\", \"lumps\": %zu, \"bytes\": %lld, "
+                    "\"compressed_bytes\": %lld, \"ratio\": %.4f, "
+                    "\"encode_mb_per_s\": %.3f, \"encode_ns_per_byte\": %.3f, "
+                    "\"decode_mb_per_s\": %.3f, \"decode_ns_per_byte\": %.3f }",
+                    first ? "" : ",", class_names[i], codec_names[codec], corpora[i].lumps.size(), corpora[i].bytes,
+                    result->compressed_bytes, (double) result->compressed_bytes / corpora[i].bytes,
+                    megabytes_per_second(corpora[i].bytes, runs, result->encode_seconds),
+                    nanoseconds_per_byte(corpora[i].bytes, runs, result->encode_seconds),
+                    megabytes_per_second(corpora[i].bytes, runs, result->decode_seconds),
+                    nanoseconds_per_byte(corpora[i].bytes, runs, result->decode_seconds));
+                first = false;
+            }
+        }
+
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+
+    return round_trip ? EXIT_SUCCESS : EXIT_FAILURE;
+}
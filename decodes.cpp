@@ -13,36 +13,94 @@ typedef struct {
     int var3;
     byte *write;
     byte *writePos;
-    byte *read;
-    byte *readPos;
+    const byte *read;
+    const byte *readPos;
 } decoder_t;
 
 /*=========*/
 /* GLOBALS */
 /*=========*/
 
-static short ShiftTable[6] = {4, 6, 8, 10, 12, 14}; // 8005D8A0
+static constexpr short ShiftTable[6] = {4, 6, 8, 10, 12, 14}; // 8005D8A0
 
-static int tableVar01[18];      // 800B2250
+/*
+    Everything a single DecodeD64 call works on. The game keeps these
+    as globals, here each call gets its own copy so that several lumps
+    can be decoded at the same time.
+*/
+typedef struct {
+    int tableVar01[18];         // 800B2250
 
-static short *PtrEvenTbl;       // 800B2298
-static short *PtrOddTbl;        // 800B229C
-static short *PtrNumTbl1;       // 800B22A0
-static short *PtrNumTbl2;       // 800B22A4
+    short *PtrEvenTbl;          // 800B2298
+    short *PtrOddTbl;           // 800B229C
+    short *PtrNumTbl1;          // 800B22A0
+    short *PtrNumTbl2;          // 800B22A4
 
-//static short EvenTable[0x275]; // DecodeTable[0]
-//static short OddTable[0x275];  // DecodeTable[0x278]
-//static short NumTable1[0x4EA]; // DecodeTable[0x4F0]
-//static short NumTable2[0x4EA]; // array01[0]
+    /* The game's DecodeTable, split in its three parts so that the
+        compiler knows a write to one of them doesn't change the others */
+    short EvenTable[0x278];     // 800B22A8
+    short OddTable[0x278];      // 800B2798
+    short NumTable1[0x4EC];     // 800B2C88
+    short array01[1258];        // 800B3660, NumTable2 in the game
 
-static short DecodeTable[2524]; // 800B22A8
-static short array01[1258];     // 800B3660
+    decoder_t decoder;          // 800B4034
+    byte *allocPtr;             // 800B4054
 
-static decoder_t decoder;       // 800B4034
-static byte *allocPtr;          // 800B4054
+    int OVERFLOW_READ;          // 800B4058
+    int OVERFLOW_WRITE;         // 800B405C
 
-static int OVERFLOW_READ;       // 800B4058
-static int OVERFLOW_WRITE;      // 800B405C
+    int PastEnd;                // zero bytes fed to the bit buffer after the input ran out
+
+    unsigned long long BitBuffer;   // upcoming input bits, next one in the top bit
+    int BitCount;
+
+    /* Work the game's decoder would do, for ProfileD64 */
+    long long CodeBits;         // bits read, the game reads each one on its own
+    long long TreeSteps;        // nodes DecodeByte and CheckTable go through
+    long long Rebuilds;         // times CheckTable halved every count
+} decodestate_t;
+
+/*
+========================
+=
+= CopyMatch
+=
+= Copies len bytes to output from distance bytes back. The copy may
+= overlap its own output, it then repeats the last distance bytes.
+= Writes exactly len bytes.
+=
+========================
+*/
+
+static inline void CopyMatch(unsigned char *output, int distance, int len)
+{
+    const unsigned char *source = output - distance;
+
+    /* No overlap, a single copy that the compiler and libc do in vector stores */
+    if (len <= distance)
+    {
+        memcpy(output, source, len);
+        return;
+    }
+
+    if (distance == 1)
+    {
+        memset(output, *source, len);
+        return;
+    }
+
+    /* A run of a short pattern, every copy doubles the bytes it can
+        copy from without overlapping, until the rest fits in one */
+    while (len > distance)
+    {
+        memcpy(output, source, distance);
+        output += distance;
+        len -= distance;
+        distance <<= 1;
+    }
+
+    memcpy(output, source, len);
+}
 
 /*
 ============================================================================
@@ -60,12 +118,15 @@ DECODE BASED ROUTINES
 ========================
 */
 
-static byte GetDecodeByte(void) // 8002D1D0
+static byte GetDecodeByte(decodestate_t *dec) // 8002D1D0
 {
-    if ((int)(decoder.readPos - decoder.read) >= OVERFLOW_READ)
-        return -1;
+    if ((int)(dec->decoder.readPos - dec->decoder.read) >= dec->OVERFLOW_READ)
+    {
+        dec->PastEnd++;
+        return 0;
+    }
 
-    return *decoder.readPos++;
+    return *dec->decoder.readPos++;
 }
 
 /*
@@ -76,12 +137,13 @@ static byte GetDecodeByte(void) // 8002D1D0
 ========================
 */
 
-static void WriteOutput(byte outByte) // 8002D214
+static void WriteOutput(decodestate_t *dec, byte outByte) // 8002D214
 {
-    if ((int)(decoder.writePos - decoder.write) >= OVERFLOW_WRITE)
-        printf("Overflowed output buffer");
+    /* Dropped rather than reported, the codecs don't print */
+    if ((int)(dec->decoder.writePos - dec->decoder.write) >= dec->OVERFLOW_WRITE)
+        return;
 
-    *decoder.writePos++ = outByte;
+    *dec->decoder.writePos++ = outByte;
 }
 
 /*
@@ -93,48 +155,63 @@ static void WriteOutput(byte outByte) // 8002D214
 ========================
 */
 
-static void WriteBinary(int binary) // 8002D288
+static void WriteBinary(decodestate_t *dec, int binary) // 8002D288
 {
-    decoder.var3 = (decoder.var3 << 1);
+    dec->decoder.var3 = (dec->decoder.var3 << 1);
 
     if (binary != 0)
-        decoder.var3 = (decoder.var3 | 1);
+        dec->decoder.var3 = (dec->decoder.var3 | 1);
 
-    decoder.var2 = (decoder.var2 + 1);
-    if (decoder.var2 == 8)
+    dec->decoder.var2 = (dec->decoder.var2 + 1);
+    if (dec->decoder.var2 == 8)
     {
-        WriteOutput((byte)decoder.var3);
-        decoder.var2 = 0;
+        WriteOutput(dec, (byte)dec->decoder.var3);
+        dec->decoder.var2 = 0;
     }
 }
 
 /*
 ========================
 =
-= DecodeScan
+= FillBits
+= tops the bit buffer up to at least 57 bits
 =
 ========================
 */
 
-static int DecodeScan(void) // 8002D2F4
+static void FillBits(decodestate_t *dec)
 {
-    int resultbyte;
-
-    resultbyte = decoder.var0;
-
-    decoder.var0 = (resultbyte - 1);
-    if ((resultbyte < 1))
+    /* A refill takes at most 8 bytes, only the end of the input needs the checked path */
+    if ((int)(dec->decoder.readPos - dec->decoder.read) <= dec->OVERFLOW_READ - 8)
     {
-        resultbyte = GetDecodeByte();
+        while (dec->BitCount <= 56)
+        {
+            dec->BitBuffer |= (unsigned long long)*dec->decoder.readPos++ << (56 - dec->BitCount);
+            dec->BitCount += 8;
+        }
+        return;
+    }
 
-        decoder.var1 = resultbyte;
-        decoder.var0 = 7;
+    while (dec->BitCount <= 56)
+    {
+        dec->BitBuffer |= (unsigned long long)GetDecodeByte(dec) << (56 - dec->BitCount);
+        dec->BitCount += 8;
     }
+}
 
-    resultbyte = (0 < (decoder.var1 & 0x80));
-    decoder.var1 = (decoder.var1 << 1);
+/*
+========================
+=
+= SkipBits
+=
+========================
+*/
 
-    return resultbyte;
+static void SkipBits(decodestate_t *dec, int count)
+{
+    dec->BitBuffer <<= count;
+    dec->BitCount -= count;
+    dec->CodeBits += count;
 }
 
 /*
@@ -146,7 +223,7 @@ static int DecodeScan(void) // 8002D2F4
 ========================
 */
 
-static void MakeExtraBinary(int binary, int shift) // 8002D364
+static void MakeExtraBinary(decodestate_t *dec, int binary, int shift) // 8002D364
 {
     int i;
 
@@ -155,7 +232,7 @@ static void MakeExtraBinary(int binary, int shift) // 8002D364
     {
         do
         {
-            WriteBinary(binary & 1);
+            WriteBinary(dec, binary & 1);
             binary = (binary >> 1);
         } while (++i != shift);
     }
@@ -169,29 +246,27 @@ static void MakeExtraBinary(int binary, int shift) // 8002D364
 ========================
 */
 
-static int RescanByte(int byte) // 8002D3B8
+static int RescanByte(decodestate_t *dec, int byte) // 8002D3B8
 {
-    int shift;
-    int i;
     int resultbyte;
 
-    resultbyte = 0;
-    i = 0;
-    shift = 1;
-
     if(byte <= 0)
-        return resultbyte;
+        return 0;
 
-    do
-    {
-        if (DecodeScan() != 0)
-            resultbyte |= shift;
+    if (dec->BitCount < byte)
+        FillBits(dec);
 
-        i++;
-        shift = (shift << 1);
-    } while (i != byte);
+    /* The first bit read is the lowest bit of the result, so the
+        bits are taken at once and then put in reverse order */
+    resultbyte = (int)(dec->BitBuffer >> (64 - byte));
+    SkipBits(dec, byte);
+
+    resultbyte = ((resultbyte & 0x5555) << 1) | ((resultbyte >> 1) & 0x5555);
+    resultbyte = ((resultbyte & 0x3333) << 2) | ((resultbyte >> 2) & 0x3333);
+    resultbyte = ((resultbyte & 0x0F0F) << 4) | ((resultbyte >> 4) & 0x0F0F);
+    resultbyte = ((resultbyte & 0x00FF) << 8) | ((resultbyte >> 8) & 0x00FF);
 
-    return resultbyte;
+    return resultbyte >> (16 - byte);
 }
 
 /*
@@ -203,100 +278,77 @@ static int RescanByte(int byte) // 8002D3B8
 ========================
 */
 
-static void WriteEndCode(void) // 8002D424
+static void WriteEndCode(decodestate_t *dec) // 8002D424
 {
-    if (decoder.var2 > 0) {
-        WriteOutput((byte)(decoder.var3 << (8 - decoder.var2)) & 0xff);
+    if (dec->decoder.var2 > 0) {
+        WriteOutput(dec, (byte)(dec->decoder.var3 << (8 - dec->decoder.var2)) & 0xff);
     }
 }
 
 /*
 ========================
 =
-= InitDecodeTable
+= MakePristineState
+= the state every lump starts decoding from, which doesn't depend on
+= the lump and so is worked out once at compile time
 =
 ========================
 */
 
-static void InitDecodeTable(void) // 8002D468
+static constexpr decodestate_t MakePristineState(void)
 {
-    int evenVal, oddVal, incrVal;
-
-    short *curArray;
-    short *incrTbl;
-    short *evenTbl;
-    short *oddTbl;
+    decodestate_t state = {};
+    decodestate_t *dec = &state;
 
-    tableVar01[15] = 3;
-    tableVar01[16] = 0;
-    tableVar01[17] = 0;
+    int evenVal = 2;
+    int oddVal = 3;
+    int incrVal = 0;
 
-    decoder.var0 = 0;
-    decoder.var1 = 0;
-    decoder.var2 = 0;
-    decoder.var3 = 0;
+    dec->tableVar01[15] = 3;
 
-    curArray = &array01[2];
-    incrTbl = &DecodeTable[0x4F2];
-
-    incrVal = 2;
-
-    do
+    for (incrVal = 2; incrVal < 1258; incrVal++)
     {
-        if(incrVal < 0) {
-            *incrTbl = (short)((incrVal + 1) >> 1);
-        }
-        else {
-            *incrTbl = (short)(incrVal >> 1);
-        }
-
-        *curArray++ = 1;
-        incrTbl++;
-    } while(++incrVal < 1258);
-
-    oddTbl  = &DecodeTable[0x279];
-    evenTbl = &DecodeTable[1];
-
-    evenVal = 2;
-    oddVal = 3;
+        dec->NumTable1[incrVal] = (short)(incrVal >> 1);
+        dec->array01[incrVal] = 1;
+    }
 
     do
     {
-        *oddTbl++ = (short)oddVal;
+        dec->OddTable[oddVal >> 1] = (short)oddVal;
         oddVal += 2;
 
-        *evenTbl++ = (short)evenVal;
+        dec->EvenTable[evenVal >> 1] = (short)evenVal;
         evenVal += 2;
 
     } while(oddVal < 1259);
 
-    tableVar01[0] = 0;
-
-    incrVal = (1 << ShiftTable[0]);
-    tableVar01[6] = (incrVal - 1);
-    tableVar01[1] = incrVal;
-
-    incrVal += (1 << ShiftTable[1]);
-    tableVar01[7] = (incrVal - 1);
-    tableVar01[2] = incrVal;
+    incrVal = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        dec->tableVar01[i] = incrVal;
+        incrVal += (1 << ShiftTable[i]);
+        dec->tableVar01[6 + i] = (incrVal - 1);
+    }
 
-    incrVal += (1 << ShiftTable[2]);
-    tableVar01[8] = (incrVal - 1);
-    tableVar01[3] = incrVal;
+    dec->tableVar01[12] = (incrVal - 1);
+    dec->tableVar01[13] = dec->tableVar01[12] + 64;
 
-    incrVal += (1 << ShiftTable[3]);
-    tableVar01[9] = (incrVal - 1);
-    tableVar01[4] = incrVal;
+    return state;
+}
 
-    incrVal += (1 << ShiftTable[4]);
-    tableVar01[10] = (incrVal - 1);
-    tableVar01[5] = incrVal;
+static constexpr decodestate_t PristineState = MakePristineState();
 
-    incrVal += (1 << ShiftTable[5]);
-    tableVar01[11] = (incrVal - 1);
-    tableVar01[12] = (incrVal - 1);
+/*
+========================
+=
+= InitDecodeTable
+=
+========================
+*/
 
-    tableVar01[13] = tableVar01[12] + 64;
+static void InitDecodeTable(decodestate_t *dec) // 8002D468
+{
+    memcpy(dec, &PristineState, sizeof(decodestate_t));
 }
 
 /*
@@ -307,60 +359,38 @@ static void InitDecodeTable(void) // 8002D468
 ========================
 */
 
-static void CheckTable(int a0,int a1,int a2) // 8002D624
+static void CheckTable(decodestate_t *dec, int node, int sibling) // 8002D624
 {
     int i;
-    int idByte1;
-    int idByte2;
-    short *curArray;
-    short *evenTbl;
-    short *oddTbl;
-    short *incrTbl;
-
-    i = 0;
-    evenTbl = &DecodeTable[0];
-    oddTbl  = &DecodeTable[0x278];
-    incrTbl = &DecodeTable[0x4F0];
-
-    idByte1 = a0;
+    int parent;
+    int grandparent;
+    long long steps;
 
+    /* Every parent on the way up gets the sum of its children again,
+        sibling is always the child that isn't on the way */
+    steps = 0;
     do {
-        idByte2 = incrTbl[idByte1];
-
-        array01[idByte2] = (array01[a1] + array01[a0]);
-
-        a0 = idByte2;
-
-        if(idByte2 != 1) {
-            idByte1 = incrTbl[idByte2];
-            idByte2 = evenTbl[idByte1];
-
-            a1 = idByte2;
-
-            if(a0 == idByte2) {
-                a1 = oddTbl[idByte1];
-            }
+        parent = dec->NumTable1[node];
+        dec->array01[parent] = (short)(dec->array01[node] + dec->array01[sibling]);
+        steps++;
+
+        node = parent;
+        if (node != 1) {
+            grandparent = dec->NumTable1[node];
+            sibling = (dec->EvenTable[grandparent] == node) ? dec->OddTable[grandparent] : dec->EvenTable[grandparent];
         }
+    } while (node != 1);
 
-        idByte1 = a0;
-    }while(a0 != 1);
+    dec->TreeSteps += steps;
 
-    if(array01[1] != 0x7D0) {
+    if (dec->array01[1] != 0x7D0) {
         return;
     }
 
-    array01[1] >>= 1;
+    dec->Rebuilds++;
 
-    curArray = &array01[2];
-    do
-    {
-        curArray[3] >>= 1;
-        curArray[2] >>= 1;
-        curArray[1] >>= 1;
-        curArray[0] >>= 1;
-        curArray += 4;
-        i += 4;
-    } while(i != 1256);
+    for (i = 1; i < 1258; i++)
+        dec->array01[i] >>= 1;
 }
 
 /*
@@ -371,85 +401,62 @@ static void CheckTable(int a0,int a1,int a2) // 8002D624
 ========================
 */
 
-static void DecodeByte(int tblpos) // 8002D72C
+static void DecodeByte(decodestate_t *dec, int tblpos) // 8002D72C
 {
-    int incrIdx;
-    int evenVal;
-    int idByte1;
-    int idByte2;
-    int idByte3;
-    int idByte4;
-
-    short *evenTbl;
-    short *oddTbl;
-    short *incrTbl;
-    short *tmpIncrTbl;
-
-    evenTbl = &DecodeTable[0];
-    oddTbl  = &DecodeTable[0x278];
-    incrTbl = &DecodeTable[0x4F0];
-
-    idByte1 = (tblpos + 0x275);
-    array01[idByte1] += 1;
-
-    if (incrTbl[idByte1] != 1)
-    {
-        tmpIncrTbl = &incrTbl[idByte1];
-        idByte2 = *tmpIncrTbl;
+    int node;
+    int parent;
+    int grandparent;
+    int uncle;
+    int sibling;
+    bool parentIsEven;
+    long long steps;
+
+    node = (tblpos + 0x275);
+    dec->array01[node] += 1;
+
+    if (dec->NumTable1[node] == 1)
+        return;
 
-        if (idByte1 == evenTbl[idByte2]) {
-            CheckTable(idByte1, oddTbl[idByte2], idByte1);
-        }
-        else {
-            CheckTable(idByte1, evenTbl[idByte2], idByte1);
-        }
+    parent = dec->NumTable1[node];
+    CheckTable(dec, node, (dec->EvenTable[parent] == node) ? dec->OddTable[parent] : dec->EvenTable[parent]);
 
-        do
-        {
-            incrIdx = incrTbl[idByte2];
-            evenVal = evenTbl[incrIdx];
+    /* A node heavier than its parent's sibling trades places with it */
+    steps = 0;
+    do
+    {
+        grandparent = dec->NumTable1[parent];
+        parentIsEven = (dec->EvenTable[grandparent] == parent);
+        uncle = parentIsEven ? dec->OddTable[grandparent] : dec->EvenTable[grandparent];
+        steps++;
 
-            if (idByte2 == evenVal) {
-                idByte3 = oddTbl[incrIdx];
+        if (dec->array01[uncle] < dec->array01[node])
+        {
+            if (parentIsEven) {
+                dec->OddTable[grandparent] = (short)node;
             }
             else {
-                idByte3 = evenVal;
+                dec->EvenTable[grandparent] = (short)node;
             }
 
-            if (array01[idByte3] < array01[idByte1])
-            {
-                if (idByte2 == evenVal) {
-                    oddTbl[incrIdx] = (short)idByte1;
-                }
-                else {
-                    evenTbl[incrIdx] = (short)idByte1;
-                }
-
-                evenVal = evenTbl[idByte2];
-
-                if (idByte1 == evenVal) {
-                    idByte4 = oddTbl[idByte2];
-                    evenTbl[idByte2] = (short)idByte3;
-                }
-                else {
-                    idByte4 = evenVal;
-                    oddTbl[idByte2] = (short)idByte3;
-                }
-
-                incrTbl[idByte3] = (short)idByte2;
-
-                *tmpIncrTbl = (short)incrIdx;
-                CheckTable(idByte3, idByte4, idByte4);
-
-                tmpIncrTbl = &incrTbl[idByte3];
+            if (dec->EvenTable[parent] == node) {
+                sibling = dec->OddTable[parent];
+                dec->EvenTable[parent] = (short)uncle;
+            }
+            else {
+                sibling = dec->EvenTable[parent];
+                dec->OddTable[parent] = (short)uncle;
             }
 
-            idByte1 = *tmpIncrTbl;
-            tmpIncrTbl = &incrTbl[idByte1];
+            dec->NumTable1[uncle] = (short)parent;
+            dec->NumTable1[node] = (short)grandparent;
+            CheckTable(dec, uncle, sibling);
+        }
 
-            idByte2 = *tmpIncrTbl;
-        } while (idByte2 != 1);
-    }
+        node = parent;
+        parent = dec->NumTable1[node];
+    } while (parent != 1);
+
+    dec->TreeSteps += steps;
 }
 
 /*
@@ -460,29 +467,31 @@ static void DecodeByte(int tblpos) // 8002D72C
 ========================
 */
 
-static int StartDecodeByte(void) // 8002D904
+static int StartDecodeByte(decodestate_t *dec) // 8002D904
 {
     int lookup;
-    short *evenTbl;
-    short *oddTbl;
 
     lookup = 1;
 
-    evenTbl = &DecodeTable[0];
-    oddTbl  = &DecodeTable[0x278];
-
+    /* Taking the bits from the bit buffer instead of a byte at a time
+        leaves only the walk itself */
     while(lookup < 0x275)
     {
-        if(DecodeScan() == 0) {
-            lookup = evenTbl[lookup];
+        if (dec->BitCount == 0)
+            FillBits(dec);
+
+        if((dec->BitBuffer >> 63) == 0) {
+            lookup = dec->EvenTable[lookup];
         }
         else {
-            lookup = oddTbl[lookup];
+            lookup = dec->OddTable[lookup];
         }
+
+        SkipBits(dec, 1);
     }
 
     lookup = (lookup + -0x275);
-    DecodeByte(lookup);
+    DecodeByte(dec, lookup);
 
     return lookup;
 }
@@ -496,25 +505,25 @@ static int StartDecodeByte(void) // 8002D904
 ========================
 */
 
-void L8002d990(int arg0) // 8002D990
+void L8002d990(decodestate_t *dec, int arg0) // 8002D990
 {
     int val;
 
-    val = ((allocPtr[(arg0 + 2) % tableVar01[13]] << 8) ^ (allocPtr[arg0] ^ (allocPtr[(arg0+1) % tableVar01[13]] << 4))) & 0x3fff;
+    val = ((dec->allocPtr[(arg0 + 2) % dec->tableVar01[13]] << 8) ^ (dec->allocPtr[arg0] ^ (dec->allocPtr[(arg0+1) % dec->tableVar01[13]] << 4))) & 0x3fff;
 
-    if (PtrEvenTbl[val] == -1)
+    if (dec->PtrEvenTbl[val] == -1)
     {
-        PtrOddTbl[val] = arg0;
-        PtrNumTbl1[arg0] = -1;
+        dec->PtrOddTbl[val] = arg0;
+        dec->PtrNumTbl1[arg0] = -1;
     }
     else
     {
-        PtrNumTbl1[arg0] = PtrEvenTbl[val];
-        PtrNumTbl2[PtrEvenTbl[val]] = arg0;
+        dec->PtrNumTbl1[arg0] = dec->PtrEvenTbl[val];
+        dec->PtrNumTbl2[dec->PtrEvenTbl[val]] = arg0;
     }
 
-    PtrEvenTbl[val] = arg0;
-    PtrNumTbl2[arg0] = -1;
+    dec->PtrEvenTbl[val] = arg0;
+    dec->PtrNumTbl2[arg0] = -1;
 }
 
 /*
@@ -526,20 +535,20 @@ void L8002d990(int arg0) // 8002D990
 ========================
 */
 
-void FUN_8002dad0(int arg0) // 8002DAD0
+void FUN_8002dad0(decodestate_t *dec, int arg0) // 8002DAD0
 {
     int val;
 
-    val = ((allocPtr[(arg0 + 2) % tableVar01[13]] << 8) ^ (allocPtr[arg0] ^ (allocPtr[(arg0+1) % tableVar01[13]] << 4))) & 0x3fff;
+    val = ((dec->allocPtr[(arg0 + 2) % dec->tableVar01[13]] << 8) ^ (dec->allocPtr[arg0] ^ (dec->allocPtr[(arg0+1) % dec->tableVar01[13]] << 4))) & 0x3fff;
 
-    if (PtrEvenTbl[val] == PtrOddTbl[val])
+    if (dec->PtrEvenTbl[val] == dec->PtrOddTbl[val])
     {
-        PtrEvenTbl[val] = -1;
+        dec->PtrEvenTbl[val] = -1;
     }
     else
     {
-        PtrNumTbl1[PtrNumTbl2[PtrOddTbl[val]]] = -1;
-        PtrOddTbl[val] = PtrNumTbl2[PtrOddTbl[val]];
+        dec->PtrNumTbl1[dec->PtrNumTbl2[dec->PtrOddTbl[val]]] = -1;
+        dec->PtrOddTbl[val] = dec->PtrNumTbl2[dec->PtrOddTbl[val]];
     }
 }
 
@@ -552,7 +561,7 @@ void FUN_8002dad0(int arg0) // 8002DAD0
 ========================
 */
 
-int FUN_8002dc0c(int start, int count) // 8002DC0C
+int FUN_8002dc0c(decodestate_t *dec, int start, int count) // 8002DC0C
 {
     short sVar1;
     int iVar2;
@@ -564,11 +573,11 @@ int FUN_8002dc0c(int start, int count) // 8002DC0C
     int curr, next;
 
     iVar4 = 0;
-    if (start == tableVar01[13]) {
+    if (start == dec->tableVar01[13]) {
         start = 0;
     }
 
-    sVar1 = PtrEvenTbl[(allocPtr[(start + 2) % tableVar01[13]] << 8 ^ allocPtr[start] ^ allocPtr[(start + 1) % tableVar01[13]] << 4) & 0x3fff];
+    sVar1 = dec->PtrEvenTbl[(dec->allocPtr[(start + 2) % dec->tableVar01[13]] << 8 ^ dec->allocPtr[start] ^ dec->allocPtr[(start + 1) % dec->tableVar01[13]] << 4) & 0x3fff];
 
     iVar5 = 1;
     do
@@ -578,32 +587,32 @@ int FUN_8002dc0c(int start, int count) // 8002DC0C
             return iVar4;
         }
 
-        if ((allocPtr[(start + iVar4) % tableVar01[13]]) ==
-            (allocPtr[(iVar2 + iVar4) % tableVar01[13]]))
+        if ((dec->allocPtr[(start + iVar4) % dec->tableVar01[13]]) ==
+            (dec->allocPtr[(iVar2 + iVar4) % dec->tableVar01[13]]))
         {
             cnt = 0;
-            if (allocPtr[start] == allocPtr[iVar2])
+            if (dec->allocPtr[start] == dec->allocPtr[iVar2])
             {
                 curr = start;
                 next = iVar2;
 
                 if(next != start)
                 {
-                    while (curr != tableVar01[15])
+                    while (curr != dec->tableVar01[15])
                     {
                         curr++;
-                        if (curr == tableVar01[13]) {
+                        if (curr == dec->tableVar01[13]) {
                             curr = 0;
                         }
 
                         next++;
-                        if (next == tableVar01[13]) {
+                        if (next == dec->tableVar01[13]) {
                             next = 0;
                         }
 
                         cnt++;
 
-                        if (allocPtr[curr] != allocPtr[next])
+                        if (dec->allocPtr[curr] != dec->allocPtr[next])
                             break;
 
                         if (cnt >= 64)
@@ -617,30 +626,30 @@ int FUN_8002dc0c(int start, int count) // 8002DC0C
 
             iVar6 = start - iVar2;
             if (iVar6 < 0) {
-                iVar6 += tableVar01[13];
+                iVar6 += dec->tableVar01[13];
             }
 
             iVar6 -= cnt;
-            if (tableVar01[16] && (tableVar01[6]/*15*/ < iVar6)) {
+            if (dec->tableVar01[16] && (dec->tableVar01[6]/*15*/ < iVar6)) {
                 return iVar4;
             }
 
-            //if (((iVar4 < cnt) && (iVar6 <= tableVar01[12])) &&
-            //((3 < cnt || (iVar6 <= tableVar01[tableVar01[17] + 9]))))
+            //if (((iVar4 < cnt) && (iVar6 <= dec->tableVar01[12])) &&
+            //((3 < cnt || (iVar6 <= dec->tableVar01[dec->tableVar01[17] + 9]))))
             if(iVar4 < cnt)
             {
-                if(iVar6 <= tableVar01[12])
+                if(iVar6 <= dec->tableVar01[12])
                 {
-                    if((cnt > 3) || (iVar6 <= tableVar01[tableVar01[17] + 9]))
+                    if((cnt > 3) || (iVar6 <= dec->tableVar01[dec->tableVar01[17] + 9]))
                     {
                         iVar4 = cnt;
-                        tableVar01[14] = iVar6;
+                        dec->tableVar01[14] = iVar6;
                     }
                 }
             }
         }
 
-        sVar1 = PtrNumTbl1[iVar2];
+        sVar1 = dec->PtrNumTbl1[iVar2];
         iVar5++;
     } while( true );
 }
@@ -654,7 +663,7 @@ int FUN_8002dc0c(int start, int count) // 8002DC0C
 ========================
 */
 
-void FUN_8002df14(void) // 8002DF14
+void FUN_8002df14(decodestate_t *dec) // 8002DF14
 {
     byte byte_val;
 
@@ -663,20 +672,20 @@ void FUN_8002df14(void) // 8002DF14
     byte *nextPtr;
     byte *next2Ptr;
 
-    curPtr = &allocPtr[0];
+    curPtr = &dec->allocPtr[0];
 
     k = 0;
     j = 0;
     i = 1;
     do
     {
-        nextPtr = &allocPtr[j];
+        nextPtr = &dec->allocPtr[j];
         if (curPtr[0] == 10)
         {
             j = i;
             if(nextPtr[0] == curPtr[1])
             {
-                next2Ptr = &allocPtr[i+1];
+                next2Ptr = &dec->allocPtr[i+1];
                 do
                 {
                     nextPtr++;
@@ -690,56 +699,115 @@ void FUN_8002df14(void) // 8002DF14
     } while (i != 67);
 
     if (k >= 16)
-        tableVar01[16] = 1;
+        dec->tableVar01[16] = 1;
 }
 
 /*
 ========================
 =
-= DecodeD64
+= FlushRing
+= hands the bytes of dec->allocPtr not yet passed on to the sink
+=
+========================
+*/
+
+static void FlushRing(decodestate_t *dec, int incrBit, int *pending, decodesink_t sink, void *context)
+{
+    int start;
+
+    start = incrBit - *pending;
+    if (start < 0)
+    {
+        /* The pending bytes wrap around the end of the ring */
+        start += dec->tableVar01[13];
+        sink(context, &dec->allocPtr[start], dec->tableVar01[13] - start);
+        start = 0;
+    }
+
+    if (incrBit > start)
+        sink(context, &dec->allocPtr[start], incrBit - start);
+
+    *pending = 0;
+}
+
+/*
+========================
+=
+= DecodeD64Stream
 =
 = Exclusive Doom 64
+= Decodes into dec->allocPtr only and passes the output on to sink in
+= chunks of up to the ring size, so memory use doesn't grow with the lump.
+= Returns false if the data needs more input or more output than given,
+= or ends before output_size bytes.
 =
 ========================
 */
 
-void DecodeD64(unsigned char *input, unsigned char *output) // 8002DFA0
+bool DecodeD64Stream(const unsigned char *input, int input_size, int output_size, decodesink_t sink, void *context) // 8002DFA0
 {
     int copyPos, storePos;
     int dec_byte, resc_byte;
     int incrBit, copyCnt, shiftPos, j;
+    int written, pending;
+    bool result;
+
+    decodestate_t state;
+    decodestate_t *dec = &state;
 
     //PRINTF_D2(WHITE, 0, 15, "DecodeD64");
 
-    InitDecodeTable();
+    InitDecodeTable(dec);
 
-    OVERFLOW_READ = ((int)0x7fffffff);
-    OVERFLOW_WRITE = ((int)0x7fffffff);
+    dec->OVERFLOW_READ = input_size;
+    dec->OVERFLOW_WRITE = output_size;
 
     incrBit = 0;
+    written = 0;
+    pending = 0;
+    result = true;
 
-    decoder.read = input;
-    decoder.readPos = input;
-    decoder.write = output;
-    decoder.writePos = output;
+    dec->decoder.read = input;
+    dec->decoder.readPos = input;
 
-    allocPtr = (byte *)malloc(tableVar01[13]);
+    /* Freed however the decode ends, the sink may throw too */
+    std::vector<byte> ring(dec->tableVar01[13]);
+    dec->allocPtr = ring.data();
 
-    dec_byte = StartDecodeByte();
+    dec_byte = StartDecodeByte(dec);
 
     while(dec_byte != 256)
     {
+        /* Codes made of the zeros past the end of the input aren't real */
+        if ((dec->BitCount < (dec->PastEnd * 8)))
+        {
+            result = false;
+            break;
+        }
+
+        /* A symbol stores at most 64 bytes, pass the ring on before
+            they could overwrite bytes the sink hasn't seen yet */
+        if (pending > dec->tableVar01[13] - 64)
+            FlushRing(dec, incrBit, &pending, sink, context);
+
         if(dec_byte < 256)
         {
             /* Decode the data directly using binary data code */
 
-            WriteOutput((byte)(dec_byte & 0xff));
-            allocPtr[incrBit] = (byte)dec_byte;
+            if (written >= dec->OVERFLOW_WRITE)
+            {
+                result = false;
+                break;
+            }
+
+            dec->allocPtr[incrBit] = (byte)dec_byte;
+            written += 1;
+            pending += 1;
 
-            /* Resets the count once the memory limit is exceeded in allocPtr,
+            /* Resets the count once the memory limit is exceeded in dec->allocPtr,
                 so to speak resets it at startup for reuse */
             incrBit += 1;
-            if(incrBit == tableVar01[13]) {
+            if(incrBit == dec->tableVar01[13]) {
                 incrBit = 0;
             }
         }
@@ -747,7 +815,7 @@ void DecodeD64(unsigned char *input, unsigned char *output) // 8002DFA0
         {
             /* Decode the data using binary data code,
                 a count is obtained for the repeated data,
-                positioning itself in the root that is being stored in allocPtr previously. */
+                positioning itself in the root that is being stored in dec->allocPtr previously. */
 
             /*  A number is obtained from a range from 0 to 5,
                 necessary to obtain a shift value in the ShiftTable*/
@@ -757,55 +825,199 @@ void DecodeD64(unsigned char *input, unsigned char *output) // 8002DFA0
             copyCnt  = (dec_byte - (shiftPos * 62)) + -254;
 
             /*  To start copying data, you receive a position number
-                that you must sum with the position of table tableVar01 */
-            resc_byte = RescanByte(ShiftTable[shiftPos]);
+                that you must sum with the position of table dec->tableVar01 */
+            resc_byte = RescanByte(dec, ShiftTable[shiftPos]);
 
             /*  with this formula the exact position is obtained
                 to start copying previously stored data */
-            copyPos = incrBit - ((tableVar01[shiftPos] + resc_byte) + copyCnt);
+            copyPos = incrBit - ((dec->tableVar01[shiftPos] + resc_byte) + copyCnt);
 
             if(copyPos < 0) {
-                copyPos += tableVar01[13];
+                copyPos += dec->tableVar01[13];
             }
 
             storePos = incrBit;
 
-            for(j = 0; j < copyCnt; j++)
+            /* Nothing was decoded before the start to copy from */
+            if ((copyCnt > dec->OVERFLOW_WRITE - written) ||
+                (dec->tableVar01[shiftPos] + resc_byte + copyCnt > written))
             {
-                /* write the copied data */
-                WriteOutput(allocPtr[copyPos]);
+                result = false;
+                break;
+            }
 
-                /* save copied data at current position in memory allocPtr */
-                allocPtr[storePos] = allocPtr[copyPos];
+            /*  The copy distance is never below the count, so the copied bytes
+                are all in dec->allocPtr already, copies that don't run past the
+                end of the ring go in one piece */
+            if ((copyPos < storePos) && (storePos + copyCnt <= dec->tableVar01[13]))
+            {
+                CopyMatch(&dec->allocPtr[storePos], storePos - copyPos, copyCnt);
+            }
+            else if ((copyPos + copyCnt <= dec->tableVar01[13]) && (storePos + copyCnt <= dec->tableVar01[13]))
+            {
+                /* The source lies a whole ring back, just ahead of the output */
+                memmove(&dec->allocPtr[storePos], &dec->allocPtr[copyPos], copyCnt);
+            }
+            else
+            {
+                for(j = 0; j < copyCnt; j++)
+                {
+                    /* save copied data at current position in memory dec->allocPtr */
+                    dec->allocPtr[storePos] = dec->allocPtr[copyPos];
 
-                storePos++; /* advance to next allocPtr memory block to store */
-                copyPos++;  /* advance to next allocPtr memory block to copy */
+                    storePos++; /* advance to next dec->allocPtr memory block to store */
+                    copyPos++;  /* advance to next dec->allocPtr memory block to copy */
 
-                /* reset the position of storePos once the memory limit is exceeded */
-                if(storePos == tableVar01[13]) {
-                    storePos = 0;
-                }
+                    /* reset the position of storePos once the memory limit is exceeded */
+                    if(storePos == dec->tableVar01[13]) {
+                        storePos = 0;
+                    }
 
-                /* reset the position of copyPos once the memory limit is exceeded */
-                if(copyPos == tableVar01[13]) {
-                    copyPos = 0;
+                    /* reset the position of copyPos once the memory limit is exceeded */
+                    if(copyPos == dec->tableVar01[13]) {
+                        copyPos = 0;
+                    }
                 }
             }
 
-            /* Resets the count once the memory limit is exceeded in allocPtr,
+            written += copyCnt;
+            pending += copyCnt;
+
+            /* Resets the count once the memory limit is exceeded in dec->allocPtr,
                 so to speak resets it at startup for reuse */
             incrBit += copyCnt;
-            if (incrBit >= tableVar01[13]) {
-                incrBit -= tableVar01[13];
+            if (incrBit >= dec->tableVar01[13]) {
+                incrBit -= dec->tableVar01[13];
             }
         }
 
-        dec_byte = StartDecodeByte();
+        dec_byte = StartDecodeByte(dec);
     }
 
-    free(allocPtr);
+    /* The end code itself has to be within the input too, and a lump
+        that ends early is as broken as one that runs too long */
+    if ((dec->BitCount < (dec->PastEnd * 8)) || (written != output_size)) {
+        result = false;
+    }
+
+    if (result)
+        FlushRing(dec, incrBit, &pending, sink, context);
 
     //PRINTF_D2(WHITE, 0, 21, "DecodeD64:End");
+
+    return result;
+}
+
+/*
+========================
+=
+= DecodeD64
+=
+= Exclusive Doom 64
+= The whole lump is in output, so copies are taken from it directly
+= and there's no dec->allocPtr ring as in DecodeD64Stream.
+= Returns false if the data needs more input or more output than given,
+= or ends before output_size bytes
+=
+========================
+*/
+
+static bool DecodeD64Counted(const unsigned char *input, int input_size, unsigned char *output, int output_size, decodecounts_t *counts)
+{
+    int dec_byte, resc_byte;
+    int copyCnt, copyDist, shiftPos;
+    int written;
+    long long literals, matches;
+
+    decodestate_t state;
+    decodestate_t *dec = &state;
+
+    InitDecodeTable(dec);
+
+    dec->OVERFLOW_READ = input_size;
+    dec->OVERFLOW_WRITE = output_size;
+
+    written = 0;
+    literals = 0;
+    matches = 0;
+
+    dec->decoder.read = input;
+    dec->decoder.readPos = input;
+
+    dec_byte = StartDecodeByte(dec);
+
+    while(dec_byte != 256)
+    {
+        /* Codes made of the zeros past the end of the input aren't real */
+        if ((dec->BitCount < (dec->PastEnd * 8)))
+            return false;
+
+        if(dec_byte < 256)
+        {
+            if (written >= dec->OVERFLOW_WRITE)
+                return false;
+
+            output[written++] = (byte)dec_byte;
+            literals++;
+        }
+        else
+        {
+            /* Same as in DecodeD64Stream, the distance back is counted from
+                the current position instead of a position in the ring */
+            shiftPos = (dec_byte + -257) / 62;
+            copyCnt  = (dec_byte - (shiftPos * 62)) + -254;
+            resc_byte = RescanByte(dec, ShiftTable[shiftPos]);
+            copyDist = (dec->tableVar01[shiftPos] + resc_byte) + copyCnt;
+
+            if ((copyCnt > dec->OVERFLOW_WRITE - written) || (copyDist > written))
+                return false;
+
+            CopyMatch(&output[written], copyDist, copyCnt);
+            written += copyCnt;
+            matches++;
+        }
+
+        dec_byte = StartDecodeByte(dec);
+    }
+
+    if (counts)
+    {
+        memset(counts, 0, sizeof(decodecounts_t));
+        counts->code_bits = dec->CodeBits;
+        counts->tree_steps = dec->TreeSteps;
+        counts->rebuilds = dec->Rebuilds;
+        counts->literals = literals;
+        counts->matches = matches;
+        counts->match_bytes = written - literals;
+    }
+
+    /* The end code itself has to be within the input too, and
+        the lump is only whole with every byte decoded */
+    return (dec->BitCount >= (dec->PastEnd * 8)) && (written == output_size);
+}
+
+bool DecodeD64(const unsigned char *input, int input_size, unsigned char *output, int output_size)
+{
+    return DecodeD64Counted(input, input_size, output, output_size, NULL);
+}
+
+/*
+========================
+=
+= ProfileD64
+=
+= Decodes like DecodeD64 and counts the work it takes
+=
+========================
+*/
+
+bool ProfileD64(const unsigned char *input, int input_size, int output_size, decodecounts_t *counts)
+{
+    std::vector<unsigned char> output(output_size > 0 ? output_size : 1);
+
+    /* Corrupt data returns before anything is counted */
+    memset(counts, 0, sizeof(decodecounts_t));
+    return DecodeD64Counted(input, input_size, output.data(), output_size, counts);
 }
 
 /*
@@ -823,61 +1035,227 @@ void DecodeD64(unsigned char *input, unsigned char *output) // 8002DFA0
 
 #define LENSHIFT 4      /* this must be log2(LOOKAHEAD_SIZE) */
 
-void DecodeJaguar(unsigned char *input, unsigned char *output) // 8002E1f4
+bool DecodeJaguar(const unsigned char *input, int input_size, unsigned char *output, int output_size) // 8002E1f4
 {
     int getidbyte = 0;
     int len;
     int pos;
-    int i;
-    unsigned char *source;
     int idbyte = 0;
+    bool checked;
+
+    const unsigned char *input_end = input + input_size;
+    unsigned char *output_start = output;
+    unsigned char *output_end = output + output_size;
 
     while (1)
     {
+        /* A token reads at most 3 bytes and writes at most LOOKAHEAD_SIZE,
+            only the ones near either end check every read and write */
+        checked = (input_end - input < 3) || (output_end - output < LOOKAHEAD_SIZE);
+
         /* get a new idbyte if necessary */
-        if (!getidbyte) idbyte = *input++;
+        if (!getidbyte)
+        {
+            if (checked && (input == input_end)) return false;
+            idbyte = *input++;
+        }
         getidbyte = (getidbyte + 1) & 7;
 
         if (idbyte & 1)
         {
+            if (checked && (input_end - input < 2)) return false;
+
             /* decompress */
             pos = *input++ << LENSHIFT;
             pos = pos | (*input >> LENSHIFT);
-            source = output - pos - 1;
             len = (*input++ & 0xf) + 1;
             if (len == 1) break;
 
+            if (pos + 1 > output - output_start) return false;
+            if (checked && (output_end - output < len)) return false;
+
             //for (i = 0; i<len; i++)
                 //*output++ = *source++;
 
-            i = 0;
-            if (len > 0)
+            CopyMatch(output, pos + 1, len);
+            output += len;
+        }
+        else
+        {
+            if (checked && ((input == input_end) || (output == output_end))) return false;
+            *output++ = *input++;
+        }
+
+        idbyte = idbyte >> 1;
+    }
+
+    /* An end code before all of the lump is as broken as a missing one */
+    return output == output_end;
+}
+
+/*
+== == == == == == == == == ==
+=
+= DecodeJaguarStream
+=
+= Same as DecodeJaguar, but decodes into a ring twice the size of the
+= window and passes the output on to sink in chunks as it fills up
+=
+== == == == == == == == == ==
+*/
+
+#define STREAM_RING_SIZE (WINDOW_SIZE * 2)
+#define STREAM_RING_MASK (STREAM_RING_SIZE - 1)
+
+static void FlushStreamRing(const unsigned char *ring, int flushed, int written, decodesink_t sink, void *context)
+{
+    int start = flushed & STREAM_RING_MASK;
+    int count = written - flushed;
+    int first = (count < STREAM_RING_SIZE - start) ? count : STREAM_RING_SIZE - start;
+
+    if (first > 0)
+        sink(context, &ring[start], first);
+
+    /* The rest wrapped around to the start of the ring */
+    if (count > first)
+        sink(context, ring, count - first);
+}
+
+bool DecodeJaguarStream(const unsigned char *input, int input_size, int output_size, decodesink_t sink, void *context)
+{
+    int getidbyte = 0;
+    int len;
+    int pos;
+    int i;
+    int idbyte = 0;
+    int written = 0;
+    int flushed = 0;
+    unsigned char ring[STREAM_RING_SIZE];
+
+    const unsigned char *input_end = input + input_size;
+
+    while (1)
+    {
+        /* A token writes at most LOOKAHEAD_SIZE bytes, pass the ring on
+            before they could overwrite bytes the sink hasn't seen yet */
+        if (written - flushed > STREAM_RING_SIZE - LOOKAHEAD_SIZE)
+        {
+            FlushStreamRing(ring, flushed, written, sink, context);
+            flushed = written;
+        }
+
+        /* get a new idbyte if necessary */
+        if (!getidbyte)
+        {
+            if (input == input_end) return false;
+            idbyte = *input++;
+        }
+        getidbyte = (getidbyte + 1) & 7;
+
+        if (idbyte & 1)
+        {
+            if (input_end - input < 2) return false;
+
+            /* decompress */
+            pos = *input++ << LENSHIFT;
+            pos = pos | (*input >> LENSHIFT);
+            len = (*input++ & 0xf) + 1;
+            if (len == 1) break;
+
+            if (pos + 1 > written) return false;
+            if (output_size - written < len) return false;
+
+            /* Matches that don't wrap around the ring go through CopyMatch */
+            if (((written & STREAM_RING_MASK) > pos) && ((written & STREAM_RING_MASK) + len <= STREAM_RING_SIZE))
             {
-                if ((len & 3))
-                {
-                    while(i != (len & 3))
-                    {
-                        *output++ = *source++;
-                        i++;
-                    }
-                }
-                while(i != len)
+                CopyMatch(&ring[written & STREAM_RING_MASK], pos + 1, len);
+                written += len;
+            }
+            else
+            {
+                for (i = 0; i < len; i++)
                 {
-                    output[0] = source[0];
-                    output[1] = source[1];
-                    output[2] = source[2];
-                    output[3] = source[3];
-                    output += 4;
-                    source += 4;
-                    i += 4;
+                    ring[written & STREAM_RING_MASK] = ring[(written - pos - 1) & STREAM_RING_MASK];
+                    written++;
                 }
             }
         }
         else
         {
-            *output++ = *input++;
+            if ((input == input_end) || (written == output_size)) return false;
+            ring[written & STREAM_RING_MASK] = *input++;
+            written++;
         }
 
         idbyte = idbyte >> 1;
     }
+
+    if (written != output_size) return false;
+
+    FlushStreamRing(ring, flushed, written, sink, context);
+
+    return true;
+}
+
+/*
+========================
+=
+= ProfileJaguar
+=
+= Walks the tokens like DecodeJaguar and counts the work it takes,
+= without writing the output anywhere
+=
+========================
+*/
+
+bool ProfileJaguar(const unsigned char *input, int input_size, int output_size, decodecounts_t *counts)
+{
+    int getidbyte = 0;
+    int len;
+    int pos;
+    int idbyte = 0;
+    int written = 0;
+
+    const unsigned char *input_end = input + input_size;
+
+    memset(counts, 0, sizeof(decodecounts_t));
+
+    while (1)
+    {
+        if (!getidbyte)
+        {
+            if (input == input_end) return false;
+            idbyte = *input++;
+            counts->flag_bytes++;
+        }
+        getidbyte = (getidbyte + 1) & 7;
+
+        if (idbyte & 1)
+        {
+            if (input_end - input < 2) return false;
+
+            pos = *input++ << LENSHIFT;
+            pos = pos | (*input >> LENSHIFT);
+            len = (*input++ & 0xf) + 1;
+            if (len == 1) break;
+
+            if (pos + 1 > written) return false;
+            if (output_size - written < len) return false;
+
+            written += len;
+            counts->matches++;
+            counts->match_bytes += len;
+        }
+        else
+        {
+            if ((input == input_end) || (written == output_size)) return false;
+            input++;
+            written++;
+            counts->literals++;
+        }
+
+        idbyte = idbyte >> 1;
+    }
+
+    return written == output_size;
 }
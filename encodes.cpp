@@ -40,134 +40,145 @@ typedef struct {
     int null2;
 } decoder_t;
 
-static decoder_t decoder;
-
 #define OVERFLOWCHECK       0x7FFFFFFF
 
 #define TABLESIZE   1280
-byte DecodeTable[TABLESIZE*4];
-
-byte array01[0xFFFFFF];     // 0x800B3660
-byte array05[0xFFFFFF];     // 0x8005D8A0
-byte tableVar01[0xFFFFFF];  // 0x800B2250
-
-int allocPtr[0xFFFFFF];
-
-//**************************************************************
-//**************************************************************
-//  Deflate_InitDecodeTable
-//**************************************************************
-//**************************************************************
-
-void Deflate_InitDecodeTable(void) {
-    int v[2];
-    int a[4];
-    byte *a0p;
-    byte *v1p;
-    byte *a1p;
-    byte *a2p;
-    byte *a3p;
-    byte *v0p;
+#define RINGSIZE    0x558F  // bytes of history the decoder keeps, tableVar01[13]
 
-    *(signed short*)array05 = 0x04;
-    *(signed short*)(array05 + 2) = 0x06;
-    *(signed short*)(array05 + 4) = 0x08;
-    *(signed short*)(array05 + 6) = 0x0A;
-    *(signed short*)(array05 + 8) = 0x0C;
-    *(signed short*)(array05 + 10) = 0x0E;
+#define MATCH_MIN       3
+#define MATCH_MAX       64
+#define MATCH_WINDOW    1024
+#define MATCH_HASHSIZE  0x4000
+#define MATCH_CHAINSIZE 0x8000  // must be a power of 2 above RINGSIZE
+#define MATCH_FARTHEST  (5456 + 0x3FFF) // largest distance past the count the decoder allows
+#define MATCH_MAX_CHAIN 256     // candidates looked at per position by the optimal parse
 
-    *(signed short*)(tableVar01+0x34) = 0x558F;
+#define OPTIMAL_BLOCKSIZE   4096    // positions parsed per snapshot of the code lengths
 
-    *(int*)(tableVar01+0x3C) = 3;
-    *(int*)(tableVar01+0x40) = 0;
-    *(int*)(tableVar01+0x44) = 0;
+#define MATCH_HASH(p)   (((p)[2] << 8 ^ (p)[0] ^ (p)[1] << 4) & (MATCH_HASHSIZE - 1))
 
-    decoder.var0 = 0;
-    decoder.var1 = 0;
-    decoder.var2 = 0;
-    decoder.var3 = 0;
+typedef struct {
+    const byte *input;
+    int size;
+    int inserted;
+    int head[MATCH_HASHSIZE];
+    int prev[MATCH_CHAINSIZE];
+} matchfinder_t;
 
-    a0p = (array01 + 4);
-    v1p = (byte*)(DecodeTable+0x9E4);
+typedef struct {
+    unsigned long long bits;    // pending bits, the oldest in the highest position
+    int count;                  // number of pending bits, always below 32 between calls
+    int pos;                    // write position in OutFile, also past its end
+} bitwriter_t;
 
-    v[0] = 2;
+//
+// Everything a single Deflate_Encode call works on. Each call sets up its
+// own context, so lumps can be encoded on several threads at once.
+// The tables are sized like the decoder's. They are still addressed as
+// bytes and read through short and int casts, so each one keeps int alignment.
+//
+typedef struct {
+    decoder_t decoder;
 
-    do {
-        if(v[0] < 0) {
-            *(signed short*)v1p = (signed short)((v[0] + 1) << 1);
-        }
-        else {
-            *(signed short*)v1p = (signed short)(v[0] >> 1);
-        }
+    alignas(4) byte DecodeTable[TABLESIZE*4];
 
-        *(signed short*)a0p = 1;
+    alignas(4) byte array01[1258 * sizeof(short)];  // 0x800B3660
+    alignas(4) byte array05[6 * sizeof(short)];     // 0x8005D8A0
+    alignas(4) byte tableVar01[18 * sizeof(int)];   // 0x800B2250
 
-        v1p += 2;
-        a0p += 2;
+    // A match is stored before the position wraps, so it can run up to
+    // MATCH_MAX bytes past the end of the ring
+    alignas(4) byte allocPtr[RINGSIZE + MATCH_MAX];
 
-    }
-    while(++v[0] < 1258);
+    matchfinder_t matchfinder;
+    bitwriter_t bitwriter;
 
-    a1p = (byte*)(DecodeTable+0x4F2);
-    a0p = (byte*)(DecodeTable+2);
+    // Bit path of the code being emitted, collected leaf to root with
+    // bit i of the path in bit (i & 31) of word (i >> 5).
+    // The tree has 0x275 internal nodes, which bounds its depth.
+    unsigned int BinaryPath[(0x275 + 31) >> 5];
 
-    v[1] = 2;
-    a[2] = 3;
+    byte *OutFile;              // NULL to only count the size
+    int OutputSize;
+    int SizeLimit;              // size of OutFile, the parse gives up once the output grows past it
+} encoder_t;
 
-    do {
-        *(signed short*)a1p = a[2];
-        a[2] += 2;
+//
+// The tables every Deflate_Encode call starts from. They don't depend on
+// the input, so they are worked out once at compile time and each call
+// copies them in. CountTable[count][shift] and ShiftVal[shift] are the
+// smallest and the span of the distances past the count each extra bit
+// size covers.
+//
+typedef struct {
+    short DecodeTable[TABLESIZE*2];
+    short array01[1258];
+    short array05[6];
+    int tableVar01[18];
 
-        *(signed short*)a0p = v[1];
-        v[1] += 2;
+    int CountTable[65][6];
+    int ShiftVal[6];
+} deflatetables_t;
 
-        a0p += 2;
-        a1p += 2;
+static constexpr deflatetables_t Deflate_MakeTables() {
+    deflatetables_t tables = {};
+    int incrVal = 0;
 
+    for(int i = 0; i < 6; i++) {
+        tables.array05[i] = (short)(4 + i * 2);
     }
-    while(a[2] < 1259);
-
-    *(int*)tableVar01 = 0;
-    v[1] = (1 << *(signed short*)(array05));
-    *(int*)(tableVar01+0x18) = (v[1] - 1);
 
-    *(int*)(tableVar01+4) = v[1];
-    v[1] += (1 << *(signed short*)(array05 + 2));
-    *(int*)(tableVar01+0x1C) = (v[1] - 1);
+    for(incrVal = 2; incrVal < 1258; incrVal++) {
+        tables.DecodeTable[0x4F0 + incrVal] = (short)(incrVal >> 1);
+        tables.array01[incrVal] = 1;
+    }
 
-    v[0] = 2;
-    a2p = (array05 + (v[0] << 1));
+    for(incrVal = 2; incrVal < 1258; incrVal += 2) {
+        tables.DecodeTable[incrVal >> 1] = (short)incrVal;
+        tables.DecodeTable[0x278 + (incrVal >> 1)] = (short)(incrVal + 1);
+    }
 
-    a[0] = (v[0] << 2);
-    a1p = (tableVar01 + a[0]);
+    incrVal = 0;
+    for(int i = 0; i < 6; i++) {
+        tables.tableVar01[i] = incrVal;
+        tables.ShiftVal[i] = (1 << tables.array05[i]) - 1;
+        incrVal += (1 << tables.array05[i]);
+        tables.tableVar01[6 + i] = (incrVal - 1);
+    }
 
-    *(signed short*)a1p = v[1];
+    tables.tableVar01[12] = (incrVal - 1);
+    tables.tableVar01[13] = tables.tableVar01[12] + 64;
+    tables.tableVar01[15] = 3;
 
-    v[1] += (1 << *(signed short*)a2p);
-    *(int*)(a1p + 4) = v[1];
+    for(int count = 0; count <= MATCH_MAX; count++) {
+        for(int i = 0; i < 6; i++) {
+            tables.CountTable[count][i] = tables.tableVar01[i] + count;
+        }
+    }
 
-    v[1] += (1 << *(signed short*)(a2p + 2));
-    *(int*)(a1p + 8) = v[1];
+    return tables;
+}
 
-#ifdef _MSC_VER
-    (int*)a3p = (int*)((byte*)(tableVar01+0x18) + a[0]);
-#else
-    a3p = ((byte*)(tableVar01+0x18) + a[0]);
-#endif
-    *(int*)a3p = (v[1] - 1);
+static constexpr deflatetables_t DeflateTables = Deflate_MakeTables();
 
-    v[1] += (1 << *(signed short*)(a2p + 4));
-    *(int*)(a1p + 12) = v[1];
+static_assert(DeflateTables.tableVar01[13] == RINGSIZE, "RINGSIZE has to match the decoder's ring");
 
-    v[1] += (1 << *(signed short*)(a2p + 6));
-    *(int*)(a3p + 4) = (v[1] - 1);
-    *(int*)(a3p + 8) = (v[1] - 1);
-    *(int*)(a3p + 0xc) = (v[1] - 1);
+//**************************************************************
+//**************************************************************
+//  Deflate_InitDecodeTable
+//**************************************************************
+//**************************************************************
 
-    v0p = (byte*)(tableVar01+0x30);
+void Deflate_InitDecodeTable(encoder_t *enc) {
+    memcpy(enc->DecodeTable, DeflateTables.DecodeTable, sizeof(DeflateTables.DecodeTable));
+    memcpy(enc->array01, DeflateTables.array01, sizeof(DeflateTables.array01));
+    memcpy(enc->array05, DeflateTables.array05, sizeof(DeflateTables.array05));
+    memcpy(enc->tableVar01, DeflateTables.tableVar01, sizeof(DeflateTables.tableVar01));
 
-    *(int*)v0p = (v[1] - 1);
-    *(int*)(v0p + 4) = ((v[1] - 1) + 64);
+    enc->decoder.var0 = 0;
+    enc->decoder.var1 = 0;
+    enc->decoder.var2 = 0;
+    enc->decoder.var3 = 0;
 }
 
 //**************************************************************
@@ -176,12 +187,12 @@ void Deflate_InitDecodeTable(void) {
 //**************************************************************
 //**************************************************************
 
-byte Deflate_GetDecodeByte(void) {
-    if(!((decoder.readPos - decoder.read) < OVERFLOWCHECK)) {
+byte Deflate_GetDecodeByte(encoder_t *enc) {
+    if(!((enc->decoder.readPos - enc->decoder.read) < OVERFLOWCHECK)) {
         return -1;
     }
 
-    return *decoder.readPos++;
+    return *enc->decoder.readPos++;
 }
 
 //**************************************************************
@@ -190,21 +201,21 @@ byte Deflate_GetDecodeByte(void) {
 //**************************************************************
 //**************************************************************
 
-int Deflate_DecodeScan(void) {
+int Deflate_DecodeScan(encoder_t *enc) {
     int resultbyte;
 
-    resultbyte = decoder.var0;
+    resultbyte = enc->decoder.var0;
 
-    decoder.var0 = (resultbyte - 1);
+    enc->decoder.var0 = (resultbyte - 1);
     if((resultbyte < 1)) {
-        resultbyte = Deflate_GetDecodeByte();
+        resultbyte = Deflate_GetDecodeByte(enc);
 
-        decoder.var1 = resultbyte;
-        decoder.var0 = 7;
+        enc->decoder.var1 = resultbyte;
+        enc->decoder.var0 = 7;
     }
 
-    resultbyte = (0 < (decoder.var1 & 0x80));
-    decoder.var1 = (decoder.var1 << 1);
+    resultbyte = (0 < (enc->decoder.var1 & 0x80));
+    enc->decoder.var1 = (enc->decoder.var1 << 1);
 
     return resultbyte;
 }
@@ -215,32 +226,32 @@ int Deflate_DecodeScan(void) {
 //**************************************************************
 //**************************************************************
 
-void Deflate_CheckTable(int a0, int a1, int a2) {
+void Deflate_CheckTable(encoder_t *enc, int a0, int a1, int a2) {
     int i = 0;
     byte *t7p;
     byte *v0p;
     int idByte1;
     int idByte2;
-    byte *tablePtr = (byte*)(DecodeTable+0x9E0);
+    byte *tablePtr = (byte*)(enc->DecodeTable+0x9E0);
 
     idByte1 = (a0 << 1);
 
     do {
         idByte2 = *(signed short*)(tablePtr + idByte1);
 
-        t7p = (array01 + (idByte2 << 1));
-        *(signed short*)t7p = (*(signed short*)(array01 + (a1 << 1)) + *(signed short*)(array01 + idByte1));
+        t7p = (enc->array01 + (idByte2 << 1));
+        *(signed short*)t7p = (*(signed short*)(enc->array01 + (a1 << 1)) + *(signed short*)(enc->array01 + idByte1));
 
         a0 = idByte2;
 
         if(idByte2 != 1) {
             idByte1 = *(signed short*)(tablePtr + (idByte2 << 1));
-            idByte2 = *(signed short*)(DecodeTable + (idByte1 << 1));
+            idByte2 = *(signed short*)(enc->DecodeTable + (idByte1 << 1));
 
             a1 = idByte2;
 
             if(a0 == idByte2) {
-                a1 = *(signed short*)((DecodeTable+0x4F0) + (idByte1 << 1));
+                a1 = *(signed short*)((enc->DecodeTable+0x4F0) + (idByte1 << 1));
             }
         }
 
@@ -249,13 +260,13 @@ void Deflate_CheckTable(int a0, int a1, int a2) {
     }
     while(a0 != 1);
 
-    if(*(signed short*)(array01 + 2) != 0x7D0) {
+    if(*(signed short*)(enc->array01 + 2) != 0x7D0) {
         return;
     }
 
-    *(signed short*)(array01 + 2) >>= 1;
+    *(signed short*)(enc->array01 + 2) >>= 1;
 
-    v0p = (byte*)(array01 + 4);
+    v0p = (byte*)(enc->array01 + 4);
 
     do {
         *(signed short*)(v0p + 6) >>= 1;
@@ -276,7 +287,7 @@ void Deflate_CheckTable(int a0, int a1, int a2) {
 //**************************************************************
 //**************************************************************
 
-void Deflate_DecodeByte(int a0) {
+void Deflate_DecodeByte(encoder_t *enc, int a0) {
     int v[2];
     int a[4];
     int s[10];
@@ -288,10 +299,10 @@ void Deflate_DecodeByte(int a0) {
     byte *s3p;
     byte *a1p;
 
-    s4p = array01;
+    s4p = enc->array01;
     v[0] = (a0 << 1);
 
-    s2p = (byte*)(DecodeTable+0x9E0);
+    s2p = (byte*)(enc->DecodeTable+0x9E0);
 
     v1p = (s4p + v[0]);
     s[5] = 1;
@@ -307,22 +318,22 @@ void Deflate_DecodeByte(int a0) {
 
     s1p = (s2p + v[1]);
 
-    s6p = (byte*)DecodeTable;
+    s6p = (byte*)enc->DecodeTable;
 
     a[3] = (*(signed short*)s1p << 1);
     a[1] = *(signed short*)(s6p + a[3]);
-    s3p = (byte*)(DecodeTable+0x4F0);
+    s3p = (byte*)(enc->DecodeTable+0x4F0);
 
     if(a[2] == a[1]) {
         a[1] = *(signed short*)(s3p + a[3]);
         a[0] = a[2];
-        Deflate_CheckTable(a[0], a[1], a[2]);
+        Deflate_CheckTable(enc, a[0], a[1], a[2]);
         a[3] = (*(signed short*)s1p << 1);
     }
     else {
         a[0] = a[2];
-        Deflate_CheckTable(a[0], a[1], a[2]);
-        s3p = (byte*)(DecodeTable+0x4F0);
+        Deflate_CheckTable(enc, a[0], a[1], a[2]);
+        s3p = (byte*)(enc->DecodeTable+0x4F0);
         a[3] = (*(signed short*)s1p << 1);
     }
 
@@ -362,7 +373,7 @@ void Deflate_DecodeByte(int a0) {
             a[0] = s[0];
             a[1] = a[2];
 
-            Deflate_CheckTable(a[0], a[1], a[2]);
+            Deflate_CheckTable(enc, a[0], a[1], a[2]);
             s1p = (s2p + (s[0] << 1));
         }
 
@@ -382,13 +393,13 @@ void Deflate_DecodeByte(int a0) {
 //**************************************************************
 //**************************************************************
 
-int Deflate_StartDecodeByte(void) {
+int Deflate_StartDecodeByte(encoder_t *enc) {
     int lookup = 1;                                 // $s0
-    byte *tablePtr1 = DecodeTable;                  // $s2
-    byte *tablePtr2 = (byte*)(DecodeTable+0x4F0);   // $s1
+    byte *tablePtr1 = enc->DecodeTable;                  // $s2
+    byte *tablePtr2 = (byte*)(enc->DecodeTable+0x4F0);   // $s1
 
     while(lookup < 0x275) {
-        if(Deflate_DecodeScan() == 0) {
+        if(Deflate_DecodeScan(enc) == 0) {
             lookup = *(signed short*)(tablePtr1 + (lookup << 1));
         }
         else {
@@ -397,7 +408,7 @@ int Deflate_StartDecodeByte(void) {
     }
 
     lookup = (lookup + (signed short)0xFD8B);
-    Deflate_DecodeByte(lookup);
+    Deflate_DecodeByte(enc, lookup);
 
     return lookup;
 }
@@ -408,7 +419,7 @@ int Deflate_StartDecodeByte(void) {
 //**************************************************************
 //**************************************************************
 
-int Deflate_RescanByte(int byte) {
+int Deflate_RescanByte(encoder_t *enc, int byte) {
     int i = 0;              // $s1
     int shift = 1;          // $s0
     int resultbyte = 0;     // $s2
@@ -418,7 +429,7 @@ int Deflate_RescanByte(int byte) {
     }
 
     do {
-        if(!(Deflate_DecodeScan() == 0)) {
+        if(!(Deflate_DecodeScan(enc) == 0)) {
             resultbyte |= shift;
         }
 
@@ -436,13 +447,13 @@ int Deflate_RescanByte(int byte) {
 //**************************************************************
 //**************************************************************
 
-void Deflate_WriteOutput(byte outByte) {
-    if(!((decoder.writePos - decoder.write) < OVERFLOWCHECK)) {
-        printf("Overflowed output buffer");
+void Deflate_WriteOutput(encoder_t *enc, byte outByte) {
+    // Dropped rather than reported, the codecs don't print
+    if(!((enc->decoder.writePos - enc->decoder.write) < OVERFLOWCHECK)) {
         return;
     }
 
-    *decoder.writePos++ = outByte;
+    *enc->decoder.writePos++ = outByte;
 }
 
 //**************************************************************
@@ -451,7 +462,7 @@ void Deflate_WriteOutput(byte outByte) {
 //**************************************************************
 //**************************************************************
 
-void Deflate_Decompress(byte *input, byte *output) {
+void Deflate_Decompress(encoder_t *enc, byte *input, byte *output) {
     int v[2];
     int a[4];
     int s[10];
@@ -471,29 +482,29 @@ void Deflate_Decompress(byte *input, byte *output) {
     byte *t2p;
     byte *t4p;
 
-    Deflate_InitDecodeTable();
+    Deflate_InitDecodeTable(enc);
     incrBit = 0;
 
-    decoder.read = input;
-    decoder.readPos = input;
+    enc->decoder.read = input;
+    enc->decoder.readPos = input;
 
-    decoder.null1 = 0x7FFFFFFF;
+    enc->decoder.null1 = 0x7FFFFFFF;
 
-    decoder.write = output;
-    decoder.writePos = output;
+    enc->decoder.write = output;
+    enc->decoder.writePos = output;
 
-    tablePtr1 = (byte*)(tableVar01+0x34);
+    tablePtr1 = (byte*)(enc->tableVar01+0x34);
 
-    decoder.null2 = 0x7FFFFFFF;
+    enc->decoder.null2 = 0x7FFFFFFF;
 
     a1p = tablePtr1;
     a[2] = 1;
     a[3] = 0;
     // Z_Alloc(a[0], a1p, a[2], a[3]);
 
-    s4p = (byte*)allocPtr;
+    s4p = (byte*)enc->allocPtr;
 
-    v[0] = Deflate_StartDecodeByte();
+    v[0] = Deflate_StartDecodeByte(enc);
 
     at = 256;
     s[0] = v[0];
@@ -506,7 +517,7 @@ void Deflate_Decompress(byte *input, byte *output) {
         // GhostlyDeath <May 15, 2010> -- loc_8002E094 is an if statement
         if(at != 0) {
             a[0] = (s[0] & 0xff);
-            Deflate_WriteOutput((byte)a[0]);
+            Deflate_WriteOutput(enc, (byte)a[0]);
 
             t8p = s4p;
             t9p = (t8p + incrBit);
@@ -540,7 +551,7 @@ void Deflate_Decompress(byte *input, byte *output) {
 
             mul = s[5] * v[0];
 
-            a[0] = *(signed short*)(array05 + t[4]);
+            a[0] = *(signed short*)(enc->array05 + t[4]);
 
             t[3] = mul;
 
@@ -548,10 +559,10 @@ void Deflate_Decompress(byte *input, byte *output) {
             s[8] += (signed short)0xFF02;       // addiu   $fp, 0xFF02
             s[3] = s[8];                // move    $s3, $fp
 
-            v[0] = Deflate_RescanByte(a[0]);
+            v[0] = Deflate_RescanByte(enc, a[0]);
 
             t[5] = (s[5] << 2);
-            t[6] = *(int*)(tableVar01 + t[5]);
+            t[6] = *(int*)(enc->tableVar01 + t[5]);
             s[1] = incrBit;
 
             t[7] = (t[6] + v[0]);
@@ -573,7 +584,7 @@ void Deflate_Decompress(byte *input, byte *output) {
                     t9p = s4p;
                     t1p = (t9p + s[0]);
                     a[0] = *(byte*)t1p;             // lbu  input, 0($t1)
-                    Deflate_WriteOutput((byte)a[0]);
+                    Deflate_WriteOutput(enc, (byte)a[0]);
 
                     v0p = s4p;
                     s[2] += 1;
@@ -610,7 +621,7 @@ void Deflate_Decompress(byte *input, byte *output) {
             }
         }
 
-        v[0] = Deflate_StartDecodeByte();
+        v[0] = Deflate_StartDecodeByte(enc);
 
         at = 256;
         s[0] = v[0];
@@ -626,208 +637,433 @@ void Deflate_Decompress(byte *input, byte *output) {
 // 12/08/2019
 // ---------------------------------------------------------------//
 
-std::vector<byte> BinCode;
-std::vector<byte> OutFile(1024 * 1024 *4);
 //FILE *out;
-static int OutputSize = 0;
-void MakeByte()
-{
-    int mult = 1;
-    //for (int BinCnt = 0; BinCnt < BinCode.size();)
-    
-    //printf("Make File Output\n");
-    
-    while(1)
-	{
-        if(!BinCode.size()){break;}
-        if(BinCode.size() < 8){break;}
-        
-        int tmpbyte = 8;
-        int i = 0;              // $s1
-        int shift = 1;          // $s0
-        int resultbyte = 0;     // $s2
-        int binary = 0;
-
-        do
-        {
-            binary = *(BinCode.begin() + (7 - i));
-            
-            if(!(binary == 0)) {
-                resultbyte |= shift;
-            }
-    
-            i++;
-            shift = (shift << 1);
-            //printf("binary %x\n",binary);
-        }
-        while(i != tmpbyte);
-        
-        for(binary = 0; binary < i; binary++)//Remove first 8 bytes
-        {
-            BinCode.erase(BinCode.begin());
-        }
-        
-        //printf("resultbyte shift %x\n",resultbyte);
-        
-        //fwrite (&resultbyte,sizeof(unsigned char), 1 ,out);
-        byte* the_byte_result = (byte*) (&resultbyte);
-        OutFile.push_back(*the_byte_result);
-        OutputSize ++;
-        //getch();
+
+//**************************************************************
+//**************************************************************
+//  Bit writer
+//
+//  Code bits are shifted MSB first into a 64-bit register and
+//  stored into OutFile 32 bits at a time. Bytes past SizeLimit
+//  are only counted, the parse stops soon after and the output
+//  isn't kept anyway.
+//**************************************************************
+//**************************************************************
+
+void BitWriter_Init(encoder_t *enc) {
+    enc->bitwriter.bits = 0;
+    enc->bitwriter.count = 0;
+    enc->bitwriter.pos = 0;
+}
+
+void BitWriter_Store(encoder_t *enc, byte value) {
+    if(enc->OutFile && enc->bitwriter.pos < enc->SizeLimit) {
+        enc->OutFile[enc->bitwriter.pos] = value;
     }
+
+    enc->bitwriter.pos++;
 }
 
+//
+// Appends the low nbits of value (at most 32), most significant bit first
+//
+void BitWriter_Put(encoder_t *enc, unsigned int value, int nbits) {
+    enc->bitwriter.bits = (enc->bitwriter.bits << nbits) | value;
+    enc->bitwriter.count += nbits;
 
-//Count Table
-int CountTable[64][6];
+    if(enc->bitwriter.count >= 32) {
+        enc->bitwriter.count -= 32;
+        unsigned int word = (unsigned int)(enc->bitwriter.bits >> enc->bitwriter.count);
 
-void InitCountTable()
-{
-     int i;
-     
-     for(i = 0; i <= 0x40; i++)
-     {
-           CountTable[i][0] = 0 + i;
-           CountTable[i][1] = 16 + i;
-           CountTable[i][2] = 80 + i;
-           CountTable[i][3] = 336 + i;
-           CountTable[i][4] = 1360 + i;
-           CountTable[i][5] = 5456 + i;
-     }
+        BitWriter_Store(enc, (byte)(word >> 24));
+        BitWriter_Store(enc, (byte)(word >> 16));
+        BitWriter_Store(enc, (byte)(word >> 8));
+        BitWriter_Store(enc, (byte)word);
+
+        enc->OutputSize += 4;
+    }
 }
 
+//
+// Pads the pending bits with zeros up to a byte boundary and stores them
+//
+void BitWriter_Flush(encoder_t *enc) {
+    if(enc->bitwriter.count & 7) {
+        BitWriter_Put(enc, 0, 8 - (enc->bitwriter.count & 7));
+    }
 
-static byte BinaryTest[32] = {0};
-void MakeBinary(int lookup, bool save)
+    while(enc->bitwriter.count > 0) {
+        enc->bitwriter.count -= 8;
+        BitWriter_Store(enc, (byte)(enc->bitwriter.bits >> enc->bitwriter.count));
+        enc->OutputSize++;
+    }
+}
+
+//
+// Emits the current code of table entry lookup and then updates the
+// adaptive tree like Deflate_StartDecodeByte does. The code is found by
+// walking the parent table at enc->DecodeTable+0x9E0, which Deflate_DecodeByte
+// keeps in sync while it rebalances, so the cost is the depth of the leaf.
+//
+void MakeBinary(encoder_t *enc, int lookup)
 {
-     byte *tablePtr1 = DecodeTable;                  // $s2
-     byte *tablePtr2 = (byte*)(DecodeTable+0x4F0);   // $s1
-    
+     byte *tablePtr1 = enc->DecodeTable;                  // $s2
+     byte *parentPtr = (byte*)(enc->DecodeTable+0x9E0);
+
      int Code = lookup;
      int Cnt = 0;
-     byte Binary[16] = {0};
-     
-     while (1)
+
+     while(lookup != 1)
      {
-         if(lookup <= 1){break;}
+         int parent = *(signed short*)(parentPtr + (lookup << 1));
 
-         for(int i = 2; i < 1264; i += 2)
+         if((Cnt & 31) == 0)
          {
-              int lookupcheck = *(signed short*)(tablePtr1 + i);
-              
-              if(lookupcheck == lookup)
-              {
-                   //scan = 0;
-                   //if(lookup == 0x0375) getch();
-                   //printf("is 0 %x, poss %x, cnt %d\n", lookup, i, Cnt+1);
-                   Binary[Cnt] = 0;
-                   lookup = (i >> 1);
-                   Cnt++;
-                   break;
-              }
+             enc->BinaryPath[Cnt >> 5] = 0;
          }
-             
-             
-         for(int i = 2; i < 1264; i += 2)
-         {
-              int lookupcheck = *(signed short*)(tablePtr2 + i);
-              
-              if(lookupcheck == lookup)
-              {
-                   //scan = 1;
-                   //if(lookup == 0x0375) getch();
-                   //printf("is 1 %x, poss %x, cnt %d\n", lookup, i, Cnt+1);
-                   Binary[Cnt] = 1;
-                   lookup = (i >> 1);
-                   Cnt++;
-                   break;
-              }
-         }
-     }
-       
-     if(save)
-     {
-         //Copy Binary
-         for(int j = 0; j < Cnt; j++)
+
+         // Even children are reached with a 0, odd children with a 1
+         if(*(signed short*)(tablePtr1 + (parent << 1)) != lookup)
          {
-              //printf("%d\n",Binary[(Cnt-1)-j]);
-              BinCode.push_back(Binary[(Cnt-1)-j]);
-              //BinCode.push_back(Binary[j]);
+             enc->BinaryPath[Cnt >> 5] |= (1u << (Cnt & 31));
          }
 
-         lookup = (Code + (signed short)0xFD8B);
-         //printf("lookup %X\n",lookup);
-         Deflate_DecodeByte(lookup);
+         Cnt++;
+         lookup = parent;
      }
-     else
+
+     // Emit root to leaf, highest word first
+     for(int w = (Cnt - 1) >> 5; w >= 0; w--)
      {
-         //Copy Binary Test
-         for(int j = 0; j < Cnt; j++)
-         {
-              BinaryTest[j] = Binary[(Cnt-1)-j];
-         }
-         
+          BitWriter_Put(enc, enc->BinaryPath[w], std::min(Cnt - (w << 5), 32));
      }
-     
+
+     lookup = (Code + (signed short)0xFD8B);
+     Deflate_DecodeByte(enc, lookup);
+
+     // The end code closes the stream on a byte boundary
      if(Code == 0x0375)
      {
-         //getch();        
-         int pow = (BinCode.size()) % 8;
-         //printf("size %d pow4 %d\n",(BinCode.size()), pow);
-         if(pow != 0)
-         {
-            //printf("Add\n");
-            for (int i = 0 ; i < (8 - pow); i++)
-            {
-              BinCode.push_back(0x00);
-            }
-         }
+         BitWriter_Flush(enc);
      }
-     
-     //if(Cnt > 16)
-        // getch();
 }
 
-void MakeExtraBinary(int Value, int Shift)
+//
+// Emits the low Shift bits of Value, least significant bit first
+//
+void MakeExtraBinary(encoder_t *enc, int Value, int Shift)
 {
-     unsigned char binario[16] = {0};
-     unsigned short pixel = Value;
+     unsigned int reversed = 0;
 
-     int cnt = 0;
-     //setcolor2(0x03);
      for(int b = 0; b < Shift; b++)
      {
-          if((pixel & 1 << b) != 0)
-          {
-               //printf("1");
-               BinCode.push_back(0x01);
-               binario[b] = 1;
-          }
-          else
-          {
-               //printf("0");
-               BinCode.push_back(0x00);//
-               binario[b] = 0;
-          }
-          
-          //if(b > 6 && b < 8) printf(" ");
+          reversed = (reversed << 1) | ((Value >> b) & 1);
      }
-     
-     //Copy Binary
-     /*for(int j = 0; j < Shift; j++)
-     {
-          //printf("%d\n",Binary[(Cnt-1)-j]);
-          BinCode.push_back(binario[j]);
-          //BinCode.push_back(Binary[j]);
-     }*/
-     
-     //printf(" %x\n",pixel);//getch();
-     //setcolor2(0x07);
+
+     BitWriter_Put(enc, reversed, Shift);
+}
+//**************************************************************
+//**************************************************************
+//  Match finder
+//
+//  Hash chains keyed on the 3-byte prefix of every input position.
+//  Reproduces the order of the original brute-force search: the
+//  longest match (3..64 bytes) wins and ties go to the nearest
+//  source. A match of length L may start at most 1024 + L bytes
+//  back, must end before the current position and may not reach
+//  behind the start of the current enc->allocPtr ring cycle.
+//**************************************************************
+//**************************************************************
+
+void MatchFinder_Init(encoder_t *enc, const byte *input, int size) {
+    enc->matchfinder.input = input;
+    enc->matchfinder.size = size;
+    enc->matchfinder.inserted = 0;
+
+    for(int i = 0; i < MATCH_HASHSIZE; i++) {
+        enc->matchfinder.head[i] = -1;
+    }
+}
+
+//
+// Hashes every position passed since the last call
+//
+void MatchFinder_Insert(encoder_t *enc, int pos) {
+    while(enc->matchfinder.inserted < pos) {
+        int p = enc->matchfinder.inserted++;
+        if(p + MATCH_MIN > enc->matchfinder.size) {
+            break;
+        }
+
+        int h = MATCH_HASH(enc->matchfinder.input + p);
+        enc->matchfinder.prev[p & (MATCH_CHAINSIZE - 1)] = enc->matchfinder.head[h];
+        enc->matchfinder.head[h] = p;
+    }
+}
+
+//
+// Returns the length of the match for input position pos (0 if none)
+// and stores its distance in rest. floor is the input position that
+// maps to the start of the ring buffer.
+//
+int MatchFinder_Find(encoder_t *enc, int pos, int floor, int *rest) {
+    const byte *input = enc->matchfinder.input;
+    int limit = std::min(MATCH_MAX, enc->matchfinder.size - pos);
+    int lowest = std::max(floor, pos - (MATCH_WINDOW + MATCH_MAX));
+    int bestLen = 0;
+
+    if(limit < MATCH_MIN) {
+        return 0;
+    }
+
+    MatchFinder_Insert(enc, pos);
+
+    for(int cand = enc->matchfinder.head[MATCH_HASH(input + pos)]; cand >= lowest;
+        cand = enc->matchfinder.prev[cand & (MATCH_CHAINSIZE - 1)]) {
+        int dist = pos - cand;
+        int maxLen = std::min(limit, dist);
+
+        if(maxLen <= bestLen) {
+            continue;
+        }
+
+        int len = 0;
+        while(len < maxLen && input[cand + len] == input[pos + len]) {
+            len++;
+        }
+
+        if(len > bestLen && len >= MATCH_MIN && dist <= MATCH_WINDOW + len) {
+            bestLen = len;
+            *rest = dist;
+
+            if(len == limit) {
+                break;
+            }
+        }
+    }
+
+    return bestLen;
+}
+
+//
+// Finds the nearest source for every match length at input position pos,
+// over the whole distance range the decoder's ring buffer allows.
+// dists[len] is set for every len from MATCH_MIN up to the returned
+// longest length, 0 for lengths without a source the decoder can reach.
+//
+int MatchFinder_FindAll(encoder_t *enc, int pos, int *dists) {
+    const byte *input = enc->matchfinder.input;
+    int limit = std::min(MATCH_MAX, enc->matchfinder.size - pos);
+    int lowest = pos - (limit + MATCH_FARTHEST);
+    int bestLen = MATCH_MIN - 1;
+    int chain = 0;
+
+    if(limit < MATCH_MIN) {
+        return 0;
+    }
+
+    MatchFinder_Insert(enc, pos);
+
+    for(int cand = enc->matchfinder.head[MATCH_HASH(input + pos)]; cand >= 0 && cand >= lowest && chain < MATCH_MAX_CHAIN;
+        cand = enc->matchfinder.prev[cand & (MATCH_CHAINSIZE - 1)], chain++) {
+        int dist = pos - cand;
+        int maxLen = std::min(limit, dist);
+
+        if(maxLen <= bestLen || input[cand + bestLen] != input[pos + bestLen]) {
+            continue;
+        }
+
+        int len = 0;
+        while(len < maxLen && input[cand + len] == input[pos + len]) {
+            len++;
+        }
+
+        // Candidates come nearest first, so each length keeps the first
+        // source that reaches it, unless that one is too far for it
+        for(int l = bestLen + 1; l <= len; l++) {
+            dists[l] = (dist - l <= MATCH_FARTHEST) ? dist : 0;
+        }
+
+        if(len > bestLen) {
+            bestLen = len;
+
+            if(len == limit) {
+                break;
+            }
+        }
+    }
+
+    return (bestLen >= MATCH_MIN) ? bestLen : 0;
 }
 
-int last_prc = 0;
+//**************************************************************
+//**************************************************************
+//  Optimal parse
+//
+//  Picks literals and matches so that the sum of their code
+//  lengths is smallest, by dynamic programming over blocks of
+//  OPTIMAL_BLOCKSIZE positions. The adaptive tree keeps changing
+//  while the block is written, so every block is priced with a
+//  snapshot of the code lengths taken before it. On the first
+//  block that snapshot is the flat starting tree, so a second
+//  pass prices every block with the lengths the first pass ended
+//  it with instead.
+//**************************************************************
+//**************************************************************
+
+static const int ClassBase[6] = {0, 16, 80, 336, 1360, 5456};
+static const int ClassLast[6] = {15, 79, 335, 1359, 5455, 21839};
+
+typedef struct {
+    int lengths[0x275];                                 // code length of every table entry
+    int cost[OPTIMAL_BLOCKSIZE + MATCH_MAX + 1];        // cheapest way to reach each position
+    short step[OPTIMAL_BLOCKSIZE + MATCH_MAX + 1];      // length of the token that gets there
+    int dist[OPTIMAL_BLOCKSIZE + MATCH_MAX + 1];        // its distance, 0 for a literal
+    int dists[MATCH_MAX + 1];
+} optimalparse_t;
+
+//
+// Returns the offset class of a match, the decoder's shiftPos
+//
+int Deflate_MatchClass(int count, int rest) {
+    int m = 0;
+    while(rest - count > ClassLast[m]) {
+        m++;
+    }
+    return m;
+}
+
+void Deflate_PutMatch(encoder_t *enc, int count, int rest) {
+    int m = Deflate_MatchClass(count, rest);
+
+    MakeBinary(enc, 0x0376 + m * 62 + (count - 3));
+    MakeExtraBinary(enc, rest - count - ClassBase[m], 4 + 2 * m);
+}
+
+//
+// Stores the depth of every leaf of the adaptive tree
+//
+void Deflate_CodeLengths(encoder_t *enc, int *lengths) {
+    short *evenTbl = (short*)enc->DecodeTable;
+    short *oddTbl = (short*)(enc->DecodeTable + 0x4F0);
+    int stack[0x275 * 2];
+    int depth[0x275 * 2];
+    int top = 0;
+
+    stack[0] = 1;
+    depth[0] = 0;
+    top = 1;
+
+    while(top > 0) {
+        top--;
+        int node = stack[top];
+        int d = depth[top];
+
+        if(node >= 0x275) {
+            lengths[node - 0x275] = d;
+            continue;
+        }
+
+        stack[top] = evenTbl[node];
+        depth[top++] = d + 1;
+        stack[top] = oddTbl[node];
+        depth[top++] = d + 1;
+    }
+}
+
+//
+// prices holds 0x275 code lengths for every block to price it with, NULL to
+// take them from the tree. If block_lengths isn't NULL, the lengths the tree
+// has after every block are appended to it, to price a later pass with.
+//
+void Deflate_OptimalParse(encoder_t *enc, const byte *input, int size,
+    const std::vector<int> *prices, std::vector<int> *block_lengths)
+{
+    // Allocation failures throw like the vectors' do, the caller decides what that means
+    std::unique_ptr<optimalparse_t> opt_ptr(new optimalparse_t);
+    optimalparse_t *opt = opt_ptr.get();
+
+    std::vector<int> tokens;
+
+    for(int start = 0, block = 0; start < size && enc->bitwriter.pos <= enc->SizeLimit; block++)
+    {
+        int end = std::min(size, start + OPTIMAL_BLOCKSIZE);
+        int horizon = std::min(size, end + MATCH_MAX) - start;
+
+        if(prices && (block + 1) * 0x275 <= (int)prices->size()) {
+            std::copy(prices->begin() + block * 0x275, prices->begin() + (block + 1) * 0x275, opt->lengths);
+        }
+        else {
+            Deflate_CodeLengths(enc, opt->lengths);
+        }
+
+        opt->cost[0] = 0;
+        for(int i = 1; i <= horizon; i++) {
+            opt->cost[i] = INT_MAX;
+        }
+
+        for(int i = 0; i < end - start; i++)
+        {
+            int c = opt->cost[i];
+
+            int literal = c + opt->lengths[input[start + i]];
+            if(literal < opt->cost[i + 1]) {
+                opt->cost[i + 1] = literal;
+                opt->step[i + 1] = 1;
+                opt->dist[i + 1] = 0;
+            }
+
+            int longest = MatchFinder_FindAll(enc, start + i, opt->dists);
+            for(int l = MATCH_MIN; l <= longest; l++) {
+                int rest = opt->dists[l];
+                if(!rest) {
+                    continue;
+                }
+
+                int m = Deflate_MatchClass(l, rest);
+                int match = c + opt->lengths[0x0376 + m * 62 + (l - 3) - 0x0275] + 4 + 2 * m;
+                if(match < opt->cost[i + l]) {
+                    opt->cost[i + l] = match;
+                    opt->step[i + l] = (short)l;
+                    opt->dist[i + l] = rest;
+                }
+            }
+        }
+
+        // Walk back from the end of the block, then write it front to back.
+        // Matches that would run past the end come up again in the next block.
+        tokens.clear();
+        for(int i = end - start; i > 0; i -= opt->step[i]) {
+            tokens.push_back(i);
+        }
+
+        for(int t = (int)tokens.size() - 1; t >= 0; t--) {
+            int i = tokens[t];
+            int pos = start + i - opt->step[i];
+
+            if(opt->dist[i]) {
+                Deflate_PutMatch(enc, opt->step[i], opt->dist[i]);
+            }
+            else {
+                MakeBinary(enc, input[pos] + 0x0275);
+            }
+        }
+
+        if(block_lengths) {
+            block_lengths->resize((block + 1) * 0x275);
+            Deflate_CodeLengths(enc, block_lengths->data() + block * 0x275);
+        }
+
+        start = end;
+    }
+}
 
-std::vector<byte> Deflate_Encode(byte *input, int size)
+//
+// The parse of the original encoder: takes the longest match at every
+// position, after replaying it against enc->allocPtr the way the
+// decoder would.
+//
+void Deflate_GreedyParse(encoder_t *enc, const byte *input, int size)
 {
      int v[2];
      int a[4];
@@ -837,10 +1073,6 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
      int div;
      int mul;
      
-     int lookup = 1;                                 // $s0
-     byte *tablePtr1 = DecodeTable;                  // $s2
-     byte *tablePtr2 = (byte*)(DecodeTable+0x4F0);   // $s1
-    
      byte *s4p;
      byte *t1p;
      byte *t2p;
@@ -848,29 +1080,24 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
      byte *t8p;
      byte *t9p;
      byte *v0p;
-     s4p = (byte*)allocPtr;
      int incrBit;
      int incrBitFile;
-     int offset;
-     bool copy;
+     int count;
+     int rest;
      bool make;
-     int i,j,k,l,m, n, bin;
+     int i,l,m;
      
-     int Max = 0x558f;
+     int Max = RINGSIZE;
      int LooKupCode = 0;
-     
-     InitCountTable();
-     Deflate_InitDecodeTable();
-     
-     OutFile.clear();
+
+     s4p = (byte*)enc->allocPtr;
      //out = fopen ("Compress.bin","wb");
      
      incrBitFile = 0;
      incrBit = 0;
-     bin = 0;
      //Paso 1 Copy 14 Bytes
      
-     for(i = 0; i < 14; i++)
+     for(i = 0; i < 14 && incrBitFile < size; i++)
      {
          t8p = s4p;
          t9p = (t8p + incrBit);
@@ -878,8 +1105,7 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
          
          //Make Binary
          LooKupCode = (input[incrBitFile] + 0x0275);
-         MakeBinary(LooKupCode, true);
-         MakeByte();
+         MakeBinary(enc, LooKupCode);
              
          incrBit++;
          incrBitFile++;
@@ -888,81 +1114,21 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
      
      while(1)
      {
-         if(incrBitFile > size) break;
-         
-         float orig_v = ((float)((incrBitFile))) /(size);
-         float prc = std::clamp(orig_v, 0.0f, 1.0f);
-         int prc_int = static_cast<int>(prc*100);
-         if (prc_int % 10 == 0 && prc_int != last_prc)
-         {
-            last_prc = prc_int;
-            printf("Compress (%d %)\n", prc_int);
-         }
-         //printf("Compress (%%%.2f)\n", prc*100);
-         
-         offset = 0;
-         copy = false;
-     
-         //int pow2 = (BinCode.size()) % 8;
-         //if(pow2 != 0)
-         for(j = 64; j >= 3; j--)
-         {
-               if(copy) break;
-               
-               int minval = incrBit - 1024;
-               for(k = incrBit; k >= minval; k--)
-               {
-                     if(copy) break;
-                     for(l = 0; l < j; l++)
-                     {
-                           offset = (k - j) + l;
-                           
-                           if(offset < 0)
-                           {
-                                 //offset += Max;
-                                 //continue;
-                                 break;
-                           }
-            
-                           //printf("offset %d poss = %d\n", offset, incrBitFile + l);
-                           //printf("A = %X || B = %X\n", s4p[offset], input[incrBitFile + l]);
-                           
-                           if(s4p[offset] != input[incrBitFile + l])
-                           {
-                               copy = false;
-                               break;
-                           }
-                           else
-                           {
-                               copy = true;
-                           }
-                           //getch();
-                     }
-               }
-         }
+         if(incrBitFile >= size) break;
+         if(enc->bitwriter.pos > enc->SizeLimit) break;
          
-         if(copy)
+         count = MatchFinder_Find(enc, incrBitFile, incrBitFile - incrBit, &rest);
+
+         if(count)
          {
                //printf("\nCopy\n");
-               //printf("offset = %d || offset1 = %d || count %d\n", offset-j, incrBit, j+1);
-               int rest = (incrBit - (offset-j));
-               int count = (j+1);
-               //printf("rest = %d\n", rest);
+               //printf("rest = %d || offset1 = %d || count %d\n", rest, incrBit, count);
                
-               //Make Count Code
-               int ShiftVal[6] = {0x0f, 0x3F, 0xFF, 0x3FF, 0xFFF, 0x3FFF};
-               int Shift = 0x04;
-               for(m = 0; m < 6; m++)
-               {
-                     //printf("Count = %d -> %d ", count, CountTable[count][m]);
-                     int maxval = CountTable[count][m] + ShiftVal[m];
-                     //printf("Max %d  Shift %X", maxval, Shift);
-                     if(rest <= maxval) {/*printf("\n");*/break; /*printf("This");*/}
-                     Shift += 2;
-               }
-               //printf("\n"); 
-               
-               int ValExtra = (rest - CountTable[count][m]);
+               //Make Count Code, the match finder never goes past the last class
+               m = Deflate_MatchClass(count, rest);
+               int Shift = 0x04 + 2 * m;
+
+               int ValExtra = (rest - DeflateTables.CountTable[count][m]);
                //printf("ValExtra = %d\n", ValExtra);
                
                if(Shift == 0x04){LooKupCode = (0x0376 + (count - 3));}
@@ -974,31 +1140,7 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
 
                //printf("Code 0x%04X ValExtra %d\n", LooKupCode, ValExtra);
                
-               //comprobando
-               
-               //BinaryTest
-               MakeBinary(LooKupCode, false);
-               
-               bin = 0;
-               lookup = 1;                                 // $s0
-               while(lookup < 0x275) {
-                    if(BinaryTest[bin] == 0) {
-                        lookup = *(signed short*)(tablePtr1 + (lookup << 1));
-                        //printf("lookup1 %X\n",lookup);
-                    }
-                    else {
-                        lookup = *(signed short*)(tablePtr2 + (lookup << 1));
-                        //printf("lookup2 %X\n",lookup);
-                    }
-                    bin++;
-               }
-               //printf("lookup %X\n",lookup);
-               //getch();
-               
-               //lookup = (lookup + (signed short)0xFD8B);
-               
-               //s[0] = (LooKupCode + (signed short)0xFD8B);
-               s[0] = (lookup + (signed short)0xFD8B);
+               s[0] = (LooKupCode + (signed short)0xFD8B);
                v[0] = 62;
                
                //s[0] = 256;
@@ -1023,7 +1165,7 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
     
                mul = s[5] * v[0];
     
-               a[0] = *(signed short*)(array05 + t[4]);
+               a[0] = *(signed short*)(enc->array05 + t[4]);
                //printf("a[0] = %X t[4] = %X\n",a[0], t[4]);
     
                t[3] = mul;
@@ -1037,12 +1179,12 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
     
                //printf("shift a[0] = %d\n",a[0]);
                int shift = a[0];
-               v[0] = ValExtra;//Deflate_RescanByte(a[0]);
+               v[0] = ValExtra;//Deflate_RescanByte(enc, a[0]);
                //printf("v[0] = %d\n",v[0]);
     
                t[5] = (s[5] << 2);
                //printf("t[5] = %d\n",t[5]);
-               t[6] = *(int*)(tableVar01 + t[5]);
+               t[6] = *(int*)(enc->tableVar01 + t[5]);
                //printf("t[6] = %d\n",t[6]);
                s[1] = incrBit;
     
@@ -1118,12 +1260,10 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
                
                if(make)
                {
-                   MakeBinary(LooKupCode, true);
-                   MakeByte();
-                   MakeExtraBinary(ValExtra, Shift);
-                   MakeByte();
+                   MakeBinary(enc, LooKupCode);
+                   MakeExtraBinary(enc, ValExtra, Shift);
                    
-                   for(i = 0; i < (j+1); i++)
+                   for(i = 0; i < count; i++)
                    {
                          t8p = s4p;
                          t9p = (t8p + incrBit);
@@ -1149,8 +1289,7 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
                    //Make Binary
                    LooKupCode = (input[incrBitFile] + 0x0275);
                    //setcolor2(0x0A);printf("Code 0x%04X -> 0x%02X\n", LooKupCode, input[incrBitFile]);setcolor2(0x07);
-                   MakeBinary(LooKupCode, true);
-                   MakeByte();
+                   MakeBinary(enc, LooKupCode);
                              
                    incrBit++;
                    incrBitFile++;
@@ -1172,8 +1311,7 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
              //Make Binary
              LooKupCode = (input[incrBitFile] + 0x0275);
              //setcolor2(0x0A);printf("Code 0x%04X -> 0x%02X\n", LooKupCode, input[incrBitFile]);setcolor2(0x07);
-             MakeBinary(LooKupCode, true);
-             MakeByte();
+             MakeBinary(enc, LooKupCode);
                      
              incrBit++;
              incrBitFile++;
@@ -1185,27 +1323,59 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
              //getch();
          }
      }
-     
-     MakeBinary(0x0375, true);
-     MakeByte();
+}
+
+//
+// Encodes input with the optimal parse if optimal is set, priced like
+// Deflate_OptimalParse takes them, else with the greedy one.
+// Returns the size like Deflate_Encode does.
+//
+static int Deflate_EncodeParse(const byte *input, int size, bool optimal,
+    const std::vector<int> *prices, std::vector<int> *block_lengths, byte *output, int capacity)
+{
+     int i;
+
+     std::unique_ptr<encoder_t> enc_ptr(new encoder_t());
+     encoder_t *enc = enc_ptr.get();
+
+     enc->OutFile = output;
+     enc->SizeLimit = capacity;
+
+     Deflate_InitDecodeTable(enc);
+     MatchFinder_Init(enc, input, size);
+
+     BitWriter_Init(enc);
+
+     if(optimal)
+     {
+        Deflate_OptimalParse(enc, input, size, prices, block_lengths);
+     }
+     else
+     {
+        Deflate_GreedyParse(enc, input, size);
+     }
+
+     MakeBinary(enc, 0x0375);
      
      
-     int Aling4 = OutputSize % 4;
+     int Aling4 = enc->OutputSize % 4;
      if(Aling4 != 0)
      {
-        //printf("Add\n");
         for (i = 0 ; i < (4 - Aling4); i++)
         {
-          //*output++ = 0;
-          int val = 0x00;
-          byte* the_byte_val = (byte*) (&val);
-          //fwrite (&val, sizeof(unsigned char), 1 ,out);
-          OutFile.push_back(*the_byte_val);
+          BitWriter_Store(enc, 0);
         }
      }
-     
+
      //fclose(out);
-     return OutFile;
+
+     // Not worth keeping, whether or not the parse stopped early
+     if(enc->bitwriter.pos > capacity)
+     {
+        return -1;
+     }
+
+     return enc->bitwriter.pos;
     /* TEST
     FILE *f3 = fopen ("Alloc2.bin","wb");
     for(i = 0; i < Max; i++)
@@ -1214,4 +1384,280 @@ std::vector<byte> Deflate_Encode(byte *input, int size)
     }
     fclose(f3);
     */
-}
\ No newline at end of file
+}
+
+int Deflate_Encode(const byte *input, int size, int level, byte *output, int capacity)
+{
+     if(level != ENCODE_MAX)
+     {
+        return Deflate_EncodeParse(input, size, false, NULL, NULL, output, capacity);
+     }
+
+     // The adaptive tree rewards repeating codes in ways the parse's prices
+     // don't see, so on small lumps the greedy parse can still come out
+     // smaller. Every later try only has to beat the best one so far, it is
+     // counted first and only written over the best one once it does.
+     std::vector<int> block_lengths;
+     int best = Deflate_EncodeParse(input, size, true, NULL, &block_lengths, output, capacity);
+     int limit = (best < 0) ? capacity : best - 1;
+
+     if(Deflate_EncodeParse(input, size, true, &block_lengths, NULL, NULL, limit) >= 0)
+     {
+        best = Deflate_EncodeParse(input, size, true, &block_lengths, NULL, output, limit);
+        limit = best - 1;
+     }
+
+     if(Deflate_EncodeParse(input, size, false, NULL, NULL, NULL, limit) >= 0)
+     {
+        best = Deflate_EncodeParse(input, size, false, NULL, NULL, output, limit);
+     }
+
+     return best;
+}
+//**************************************************************
+//**************************************************************
+//  Jaguar LZSS encoder
+//
+//  Writes the format DecodeJaguar reads: a flag byte ahead of
+//  every 8 tokens, read lowest bit first, 1 for a match and 0 for
+//  a literal byte. A match is 2 bytes holding 12 bits of distance
+//  minus one and 4 bits of length minus one, a match of length 1
+//  ends the data. Matches may overlap their own output.
+//**************************************************************
+//**************************************************************
+
+#define JAGUAR_WINDOW_SIZE      4096
+#define JAGUAR_LOOKAHEAD_SIZE   16
+#define JAGUAR_MATCH_MIN        3
+#define JAGUAR_HASHSIZE         0x1000
+#define JAGUAR_MAX_CHAIN        256     // candidates looked at per position, all of them for ENCODE_MAX
+
+#define JAGUAR_LITERAL_BITS     9       // flag and byte
+#define JAGUAR_MATCH_BITS       17      // flag and 2 bytes
+
+#define JAGUAR_HASH(p)  (((p)[0] << 8 ^ (p)[1] << 4 ^ (p)[2]) & (JAGUAR_HASHSIZE - 1))
+
+typedef struct {
+    const byte *input;
+    int size;
+    int inserted;
+    int head[JAGUAR_HASHSIZE];
+    int prev[JAGUAR_WINDOW_SIZE];
+    int maxchain;
+
+    byte *OutFile;              // NULL to only count the size
+    int pos;                    // write position in OutFile, also past its end
+    int flagpos;                // flag byte of the current group of 8 tokens
+    int flagbit;                // next token's bit in it, 8 once the group is full
+    int sizelimit;              // size of OutFile, the parse gives up once the output grows past it
+    bool gaveup;                // stopped before the end, so there is no output
+} jaguarencoder_t;
+
+// Bytes past sizelimit are only counted, like the D64 bit writer does
+void Jaguar_PutByte(jaguarencoder_t *jag, byte value) {
+    if(jag->OutFile && jag->pos < jag->sizelimit) {
+        jag->OutFile[jag->pos] = value;
+    }
+
+    jag->pos++;
+}
+
+void Jaguar_PutFlag(jaguarencoder_t *jag, int match) {
+    if(jag->flagbit == 8) {
+        jag->flagpos = jag->pos;
+        jag->flagbit = 0;
+        Jaguar_PutByte(jag, 0);
+    }
+
+    if(match && jag->OutFile && jag->flagpos < jag->sizelimit) {
+        jag->OutFile[jag->flagpos] |= (1 << jag->flagbit);
+    }
+
+    jag->flagbit++;
+}
+
+void Jaguar_PutMatch(jaguarencoder_t *jag, int dist, int len) {
+    Jaguar_PutFlag(jag, 1);
+    Jaguar_PutByte(jag, (byte)((dist - 1) >> 4));
+    Jaguar_PutByte(jag, (byte)(((dist - 1) & 0xf) << 4 | (len - 1)));
+}
+
+//
+// Returns the length of the longest match for input position pos
+// (0 if none) and stores its distance in dist.
+//
+int Jaguar_FindMatch(jaguarencoder_t *jag, int pos, int *dist) {
+    const byte *input = jag->input;
+    int limit = std::min(JAGUAR_LOOKAHEAD_SIZE, jag->size - pos);
+    int lowest = pos - JAGUAR_WINDOW_SIZE;
+    int bestLen = 0;
+    int chain = 0;
+
+    if(limit < JAGUAR_MATCH_MIN) {
+        return 0;
+    }
+
+    // Hash every position passed since the last call
+    while(jag->inserted < pos) {
+        int p = jag->inserted++;
+        if(p + JAGUAR_MATCH_MIN > jag->size) {
+            break;
+        }
+
+        int h = JAGUAR_HASH(input + p);
+        jag->prev[p & (JAGUAR_WINDOW_SIZE - 1)] = jag->head[h];
+        jag->head[h] = p;
+    }
+
+    for(int cand = jag->head[JAGUAR_HASH(input + pos)]; cand >= 0 && cand >= lowest && chain < jag->maxchain;
+        cand = jag->prev[cand & (JAGUAR_WINDOW_SIZE - 1)], chain++) {
+        // Only a candidate that also matches one byte further can be longer
+        if(input[cand + bestLen] != input[pos + bestLen]) {
+            continue;
+        }
+
+        int len = 0;
+        while(len < limit && input[cand + len] == input[pos + len]) {
+            len++;
+        }
+
+        if(len > bestLen) {
+            bestLen = len;
+            *dist = pos - cand;
+
+            if(len == limit) {
+                break;
+            }
+        }
+    }
+
+    return (bestLen >= JAGUAR_MATCH_MIN) ? bestLen : 0;
+}
+
+void Jaguar_GreedyParse(jaguarencoder_t *jag)
+{
+    int pos = 0;
+    while(pos < jag->size && jag->pos <= jag->sizelimit)
+    {
+        int dist = 0;
+        int len = Jaguar_FindMatch(jag, pos, &dist);
+
+        // Lazy matching: a longer match one byte on is worth a literal first
+        if(len && len < JAGUAR_LOOKAHEAD_SIZE)
+        {
+            int nextDist;
+            if(Jaguar_FindMatch(jag, pos + 1, &nextDist) > len) {
+                len = 0;
+            }
+        }
+
+        if(len)
+        {
+            Jaguar_PutMatch(jag, dist, len);
+            pos += len;
+        }
+        else
+        {
+            Jaguar_PutFlag(jag, 0);
+            Jaguar_PutByte(jag, jag->input[pos]);
+            pos++;
+        }
+    }
+}
+
+//
+// Parses the whole input for the fewest bits. Every token has a fixed
+// cost, so walking back from the end gives the exact optimum.
+//
+void Jaguar_OptimalParse(jaguarencoder_t *jag)
+{
+    const byte *input = jag->input;
+    int size = jag->size;
+    std::vector<int> lens(size + 1);
+    std::vector<int> dists(size + 1);
+    std::vector<int> cost(size + 1);
+
+    for(int pos = 0; pos < size; pos++) {
+        lens[pos] = Jaguar_FindMatch(jag, pos, &dists[pos]);
+    }
+
+    // From here on lens holds the chosen token length at every position
+    cost[size] = 0;
+    for(int pos = size - 1; pos >= 0; pos--)
+    {
+        int longest = lens[pos];
+
+        cost[pos] = JAGUAR_LITERAL_BITS + cost[pos + 1];
+        lens[pos] = 1;
+
+        // A match reaches every shorter length from the same source
+        for(int len = JAGUAR_MATCH_MIN; len <= longest; len++) {
+            if(JAGUAR_MATCH_BITS + cost[pos + len] < cost[pos]) {
+                cost[pos] = JAGUAR_MATCH_BITS + cost[pos + len];
+                lens[pos] = len;
+            }
+        }
+    }
+
+    // The cost is exact, an output that won't fit isn't written at all
+    if((cost[0] + 7) / 8 > jag->sizelimit) {
+        jag->gaveup = true;
+        return;
+    }
+
+    for(int pos = 0; pos < size; pos += lens[pos])
+    {
+        if(lens[pos] > 1)
+        {
+            Jaguar_PutMatch(jag, dists[pos], lens[pos]);
+        }
+        else
+        {
+            Jaguar_PutFlag(jag, 0);
+            Jaguar_PutByte(jag, input[pos]);
+        }
+    }
+}
+
+int EncodeJaguar(const byte *input, int size, int level, byte *output, int capacity)
+{
+    std::unique_ptr<jaguarencoder_t> jag_ptr(new jaguarencoder_t);
+    jaguarencoder_t *jag = jag_ptr.get();
+
+    jag->input = input;
+    jag->size = size;
+    jag->inserted = 0;
+    jag->OutFile = output;
+    jag->pos = 0;
+    jag->flagpos = 0;
+    jag->flagbit = 8;
+    jag->maxchain = (level == ENCODE_MAX) ? JAGUAR_WINDOW_SIZE : JAGUAR_MAX_CHAIN;
+    jag->sizelimit = capacity;
+    jag->gaveup = false;
+
+    for(int i = 0; i < JAGUAR_HASHSIZE; i++) {
+        jag->head[i] = -1;
+    }
+
+    if(level == ENCODE_MAX) {
+        Jaguar_OptimalParse(jag);
+    }
+    else {
+        Jaguar_GreedyParse(jag);
+    }
+
+    // End code
+    Jaguar_PutMatch(jag, 1, 1);
+
+    // Keep the next lump 4 byte aligned, like Deflate_Encode does
+    while(jag->pos % 4 != 0) {
+        Jaguar_PutByte(jag, 0);
+    }
+
+    // Not worth keeping, whether or not the parse stopped early
+    if(jag->gaveup || jag->pos > capacity) {
+        return -1;
+    }
+
+    return jag->pos;
+}
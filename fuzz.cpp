@@ -0,0 +1,635 @@
+#include "wadutil64_def.h"
+
+// Checks the codecs on any input: every lump has to come back the same through
+// both encoders and every decoder, and every decoder has to agree with a plain
+// reference decoder on what data decodes to and on which data isn't a valid
+// lump, without reading or writing out of bounds. Builds as a libFuzzer target
+// with WADUTIL64_LIBFUZZER, else runs over the files given and random lumps.
+
+// The paths the differential check goes through, timed when run by hand
+typedef enum
+{
+    PATH_D64_ENCODE_FAST,
+    PATH_D64_ENCODE_MAX,
+    PATH_D64_DECODE,
+    PATH_D64_STREAM,
+    PATH_D64_PROFILE,
+    PATH_D64_REFERENCE,
+    PATH_JAGUAR_ENCODE_FAST,
+    PATH_JAGUAR_ENCODE_MAX,
+    PATH_JAGUAR_DECODE,
+    PATH_JAGUAR_STREAM,
+    PATH_JAGUAR_PROFILE,
+    PATH_JAGUAR_REFERENCE,
+    NUM_PATHS
+} fuzzpath;
+
+static const char* path_names[NUM_PATHS] = {
+    "d64 encode fast", "d64 encode max", "d64 decode", "d64 stream", "d64 profile", "d64 reference",
+    "jaguar encode fast", "jaguar encode max", "jaguar decode", "jaguar stream", "jaguar profile", "jaguar reference"
+};
+
+typedef struct
+{
+    long long   bytes;      // uncompressed bytes that went through
+    double      seconds;
+} pathtiming_t;
+
+// The optimal parse is slow enough to hold the fuzzer up on long inputs
+#define MAX_OPTIMAL_SIZE    16384
+
+static void fail(const char* what, fuzzpath path, size_t size)
+{
+    // abort doesn't flush, the message would be lost when the output goes to a pipe
+    printf("ERROR: %s in %s on a %zu byte input!\n", what, path_names[path], size);
+    fflush(stdout);
+    abort();
+}
+
+static void collect_output(void* context, const byte* data, int size)
+{
+    std::vector<byte>* output = (std::vector<byte>*) context;
+    output->insert(output->end(), data, data + size);
+}
+
+static double clock_seconds(const pathtiming_t* timings)
+{
+    if (!timings)
+    {
+        return 0;
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void add_time(pathtiming_t* timings, fuzzpath path, int size, double start)
+{
+    if (timings)
+    {
+        timings[path].bytes += size;
+        timings[path].seconds += clock_seconds(timings) - start;
+    }
+}
+
+// The reference decoders follow the game's code as plainly as possible: one bit
+// and one byte at a time, the D64 tree walked from the root for every code and
+// matches copied byte by byte. They share nothing with decodes.cpp, so a bit
+// buffer or copy shortcut there that goes wrong shows up as a disagreement.
+// lzss_decoder.py can't be one of them, it reads a text token format instead
+// of the game's.
+
+typedef struct
+{
+    const byte*     input;
+    int             input_size;
+    long long       bits_read;      // past the end of the input the bits read as zeros
+    short           left[0x278];    // children of every inner node, leaves are 0x275 + their symbol
+    short           right[0x278];
+    short           parent[1258];
+    short           weight[1258];   // times every leaf was decoded, summed up the tree
+} referenced64_t;
+
+static int reference_bit(referenced64_t* ref)
+{
+    long long byte_pos = ref->bits_read >> 3;
+    int bit = 7 - (int) (ref->bits_read & 7);
+    ref->bits_read++;
+
+    if (byte_pos >= ref->input_size)
+    {
+        return 0;
+    }
+
+    return (ref->input[byte_pos] >> bit) & 1;
+}
+
+// The game's CheckTable: new weights from node up to the root, halved once the root reaches 2000
+static void reference_add_weights(referenced64_t* ref, int node, int sibling)
+{
+    int child = node;
+    do
+    {
+        int parent = ref->parent[child];
+        ref->weight[parent] = ref->weight[sibling] + ref->weight[node];
+        node = parent;
+
+        if (parent != 1)
+        {
+            int grandparent = ref->parent[parent];
+            sibling = (ref->left[grandparent] == parent) ? ref->right[grandparent] : ref->left[grandparent];
+        }
+
+        child = node;
+    } while (node != 1);
+
+    if (ref->weight[1] == 2000)
+    {
+        for (int i = 1; i < 1258; ++i)
+        {
+            ref->weight[i] >>= 1;
+        }
+    }
+}
+
+// The game's DecodeByte: counts symbol and swaps nodes that outweigh their parent's sibling
+static void reference_count(referenced64_t* ref, int symbol)
+{
+    int node = symbol + 0x275;
+    ref->weight[node]++;
+
+    if (ref->parent[node] == 1)
+    {
+        return;
+    }
+
+    int parent = ref->parent[node];
+    reference_add_weights(ref, node, (ref->left[parent] == node) ? ref->right[parent] : ref->left[parent]);
+
+    do
+    {
+        int grandparent = ref->parent[parent];
+        bool parent_is_left = ref->left[grandparent] == parent;
+        int uncle = parent_is_left ? ref->right[grandparent] : ref->left[grandparent];
+
+        if (ref->weight[uncle] < ref->weight[node])
+        {
+            if (parent_is_left)
+            {
+                ref->right[grandparent] = node;
+            }
+            else
+            {
+                ref->left[grandparent] = node;
+            }
+
+            int sibling;
+            if (ref->left[parent] == node)
+            {
+                sibling = ref->right[parent];
+                ref->left[parent] = uncle;
+            }
+            else
+            {
+                sibling = ref->left[parent];
+                ref->right[parent] = uncle;
+            }
+
+            ref->parent[uncle] = parent;
+            ref->parent[node] = grandparent;
+            reference_add_weights(ref, uncle, sibling);
+        }
+
+        node = parent;
+        parent = ref->parent[node];
+    } while (parent != 1);
+}
+
+static bool reference_decode_d64(const byte* input, int input_size, byte* output, int output_size)
+{
+    static const int shifts[6] = { 4, 6, 8, 10, 12, 14 };
+
+    referenced64_t ref;
+    memset(&ref, 0, sizeof(ref));
+    ref.input = input;
+    ref.input_size = input_size;
+
+    for (int i = 1; i < 0x278; ++i)
+    {
+        ref.left[i] = (short) (2 * i);
+        ref.right[i] = (short) (2 * i + 1);
+    }
+    for (int i = 2; i < 1258; ++i)
+    {
+        ref.parent[i] = (short) (i / 2);
+        ref.weight[i] = 1;
+    }
+
+    int written = 0;
+    while (true)
+    {
+        int node = 1;
+        while (node < 0x275)
+        {
+            node = reference_bit(&ref) ? ref.right[node] : ref.left[node];
+        }
+
+        int symbol = node - 0x275;
+        reference_count(&ref, symbol);
+
+        // Codes made of the zeros past the end of the input aren't real
+        if (ref.bits_read > (long long) input_size * 8)
+        {
+            return false;
+        }
+
+        // The lump is only whole with every byte decoded
+        if (symbol == 256)
+        {
+            return written == output_size;
+        }
+
+        if (symbol < 256)
+        {
+            if (written == output_size)
+            {
+                return false;
+            }
+
+            output[written++] = (byte) symbol;
+            continue;
+        }
+
+        // Every group of 62 match codes has its own range of distances
+        int group = (symbol - 257) / 62;
+        int length = symbol - group * 62 - 254;
+        int distance = length;
+        for (int i = 0; i < group; ++i)
+        {
+            distance += 1 << shifts[i];
+        }
+        for (int i = 0; i < shifts[group]; ++i)
+        {
+            distance += reference_bit(&ref) << i;
+        }
+
+        if (length > output_size - written || distance > written)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < length; ++i, ++written)
+        {
+            output[written] = output[written - distance];
+        }
+    }
+}
+
+static bool reference_decode_jaguar(const byte* input, int input_size, byte* output, int output_size)
+{
+    int read = 0;
+    int written = 0;
+    int flags = 0;
+
+    for (int token = 0; ; ++token)
+    {
+        if (token % 8 == 0)
+        {
+            if (read == input_size)
+            {
+                return false;
+            }
+
+            flags = input[read++];
+        }
+
+        bool match = (flags >> (token % 8)) & 1;
+        if (!match)
+        {
+            if (read == input_size || written == output_size)
+            {
+                return false;
+            }
+
+            output[written++] = input[read++];
+            continue;
+        }
+
+        if (input_size - read < 2)
+        {
+            return false;
+        }
+
+        int distance = ((input[read] << 4) | (input[read + 1] >> 4)) + 1;
+        int length = (input[read + 1] & 0xF) + 1;
+        read += 2;
+
+        if (length == 1)
+        {
+            return written == output_size;
+        }
+
+        if (distance > written || length > output_size - written)
+        {
+            return false;
+        }
+
+        for (int i = 0; i < length; ++i, ++written)
+        {
+            output[written] = output[written - distance];
+        }
+    }
+}
+
+typedef struct
+{
+    bool                decoded;
+    std::vector<byte>   output;
+} decoderesult_t;
+
+// Decodes compressed through the reference decoder of the codec, whose result is the one
+// returned, and through the buffer, streaming and profiling decoders, which all have to
+// agree with it on whether it is valid and on what it decodes to
+static void decode_all_ways(const byte* compressed, int compressed_size, int output_size, bool d64,
+    decoderesult_t* result, pathtiming_t* timings)
+{
+    fuzzpath reference_path = d64 ? PATH_D64_REFERENCE : PATH_JAGUAR_REFERENCE;
+    fuzzpath decode_path = d64 ? PATH_D64_DECODE : PATH_JAGUAR_DECODE;
+    fuzzpath stream_path = d64 ? PATH_D64_STREAM : PATH_JAGUAR_STREAM;
+    fuzzpath profile_path = d64 ? PATH_D64_PROFILE : PATH_JAGUAR_PROFILE;
+
+    // Exactly output_size, so writing past it is caught by the address sanitizer
+    result->output.assign(output_size, 0);
+    double start = clock_seconds(timings);
+    if (d64)
+    {
+        result->decoded = reference_decode_d64(compressed, compressed_size, result->output.data(), output_size);
+    }
+    else
+    {
+        result->decoded = reference_decode_jaguar(compressed, compressed_size, result->output.data(), output_size);
+    }
+    add_time(timings, reference_path, output_size, start);
+
+    std::vector<byte> decoded_output(output_size, 0);
+    start = clock_seconds(timings);
+    bool decoded;
+    if (d64)
+    {
+        decoded = DecodeD64(compressed, compressed_size, decoded_output.data(), output_size);
+    }
+    else
+    {
+        decoded = DecodeJaguar(compressed, compressed_size, decoded_output.data(), output_size);
+    }
+    add_time(timings, decode_path, output_size, start);
+
+    std::vector<byte> streamed;
+    start = clock_seconds(timings);
+    bool stream_decoded;
+    if (d64)
+    {
+        stream_decoded = DecodeD64Stream(compressed, compressed_size, output_size, collect_output, &streamed);
+    }
+    else
+    {
+        stream_decoded = DecodeJaguarStream(compressed, compressed_size, output_size, collect_output, &streamed);
+    }
+    add_time(timings, stream_path, output_size, start);
+
+    decodecounts_t counts;
+    start = clock_seconds(timings);
+    bool profiled;
+    if (d64)
+    {
+        profiled = ProfileD64(compressed, compressed_size, output_size, &counts);
+    }
+    else
+    {
+        profiled = ProfileJaguar(compressed, compressed_size, output_size, &counts);
+    }
+    add_time(timings, profile_path, output_size, start);
+
+    if (decoded != result->decoded)
+    {
+        fail("the decoder disagrees with the reference on whether the data is valid", decode_path, compressed_size);
+    }
+    if (stream_decoded != result->decoded)
+    {
+        fail("the streaming decoder disagrees with the reference on whether the data is valid", stream_path, compressed_size);
+    }
+    if (profiled != result->decoded)
+    {
+        fail("the profiler disagrees with the reference on whether the data is valid", profile_path, compressed_size);
+    }
+
+    // Only a complete decode has to match, a failed one may stop anywhere
+    if (!result->decoded)
+    {
+        return;
+    }
+
+    if (decoded_output != result->output)
+    {
+        fail("the decoder decodes differently from the reference", decode_path, compressed_size);
+    }
+    if (streamed.size() > (size_t) output_size ||
+        (!streamed.empty() && memcmp(streamed.data(), result->output.data(), streamed.size())))
+    {
+        fail("the streaming decoder decodes differently from the reference", stream_path, compressed_size);
+    }
+    if (counts.literals + counts.match_bytes > output_size)
+    {
+        fail("the profiler counts more bytes than were decoded", profile_path, compressed_size);
+    }
+}
+
+// Returns the size the lump is encoded to
+static size_t round_trip(const byte* data, int size, bool d64, int level, pathtiming_t* timings)
+{
+    fuzzpath encode_path;
+    if (d64)
+    {
+        encode_path = (level == ENCODE_MAX) ? PATH_D64_ENCODE_MAX : PATH_D64_ENCODE_FAST;
+    }
+    else
+    {
+        encode_path = (level == ENCODE_MAX) ? PATH_JAGUAR_ENCODE_MAX : PATH_JAGUAR_ENCODE_FAST;
+    }
+
+    // More than either codec grows a lump to
+    std::vector<byte> compressed(size + size / 4 + 64);
+
+    double start = clock_seconds(timings);
+    int encoded = d64 ? Deflate_Encode(data, size, level, compressed.data(), (int) compressed.size()) :
+        EncodeJaguar(data, size, level, compressed.data(), (int) compressed.size());
+    add_time(timings, encode_path, size, start);
+
+    if (encoded < 0)
+    {
+        fail("nothing came out with room for any lump", encode_path, size);
+    }
+
+    compressed.resize(encoded);
+    size_t encoded_size = compressed.size();
+
+    decoderesult_t result;
+    decode_all_ways(compressed.data(), (int) compressed.size(), size, d64, &result, timings);
+    if (!result.decoded || memcmp(result.output.data(), data, size))
+    {
+        fail("the lump doesn't decode back the same", encode_path, size);
+    }
+
+    // An output just large enough gets the same, one byte less gets nothing, and counting alone the size
+    std::vector<byte> limited(encoded_size);
+    int limited_size = d64 ? Deflate_Encode(data, size, level, limited.data(), (int) encoded_size) :
+        EncodeJaguar(data, size, level, limited.data(), (int) encoded_size);
+    if (limited_size != encoded || limited != compressed)
+    {
+        fail("an output just large enough doesn't get the same", encode_path, size);
+    }
+
+    limited_size = d64 ? Deflate_Encode(data, size, level, limited.data(), encoded - 1) :
+        EncodeJaguar(data, size, level, limited.data(), encoded - 1);
+    if (limited_size >= 0)
+    {
+        fail("the size limit is ignored", encode_path, size);
+    }
+
+    limited_size = d64 ? Deflate_Encode(data, size, level, NULL, INT_MAX) : EncodeJaguar(data, size, level, NULL, INT_MAX);
+    if (limited_size != encoded)
+    {
+        fail("counting alone gets another size", encode_path, size);
+    }
+
+    // Damaged compressed data mustn't get out of bounds either, the lump's own bytes pick what to damage
+    for (int i = 0; i < 4 && i < size; ++i)
+    {
+        compressed[(data[i] * 2654435761u + i) % compressed.size()] ^= (byte) (data[size - 1 - i] | 1);
+        decode_all_ways(compressed.data(), (int) compressed.size(), size, d64, &result, NULL);
+    }
+
+    return encoded_size;
+}
+
+// The first 2 bytes of a hostile input are the size it claims to decode to, the rest its data
+static void decode_hostile(const byte* data, size_t size)
+{
+    if (size < 2)
+    {
+        return;
+    }
+
+    int output_size = data[0] | (data[1] << 8);
+    decoderesult_t result;
+    decode_all_ways(data + 2, (int) size - 2, output_size, true, &result, NULL);
+    decode_all_ways(data + 2, (int) size - 2, output_size, false, &result, NULL);
+}
+
+// Aborts on the first disagreement, which is what a fuzzer looks for
+static void check_input(const byte* data, size_t size, pathtiming_t* timings)
+{
+    decode_hostile(data, size);
+
+    if (size == 0 || size > INT_MAX / 2)
+    {
+        return;
+    }
+
+    for (int codec = 0; codec < 2; ++codec)
+    {
+        size_t fast_size = round_trip(data, (int) size, codec == 0, ENCODE_FAST, timings);
+
+        // The max level is only worth choosing if it is never larger
+        if (size <= MAX_OPTIMAL_SIZE &&
+            round_trip(data, (int) size, codec == 0, ENCODE_MAX, timings) > fast_size)
+        {
+            fail("the max level comes out larger than the fast one", codec == 0 ? PATH_D64_ENCODE_MAX : PATH_JAGUAR_ENCODE_MAX, size);
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size)
+{
+    check_input(data, size, NULL);
+    return 0;
+}
+
+#ifndef WADUTIL64_LIBFUZZER
+
+static unsigned int random_state = 1;
+
+static unsigned int next_random()
+{
+    random_state = random_state * 1103515245 + 12345;
+    return (random_state >> 16) & 0x7FFF;
+}
+
+// Runs of repeated bytes and repeated strings between random ones, so both
+// codecs find matches of every length and distance
+static std::vector<byte> make_lump()
+{
+    std::vector<byte> lump(1 + next_random() % 12000);
+
+    for (size_t i = 0; i < lump.size(); )
+    {
+        size_t run = 1 + next_random() % 40;
+        int kind = i ? next_random() % 3 : 0;
+        size_t distance = (kind == 2) ? 1 + next_random() % std::min(i, (size_t) 4096) : 1;
+
+        for (size_t j = 0; j < run && i < lump.size(); ++j, ++i)
+        {
+            lump[i] = kind ? lump[i - distance] : (byte) next_random();
+        }
+    }
+
+    return lump;
+}
+
+static void fuzz_help()
+{
+    printf("USAGE: wadutil64_fuzz [--random=N] [--seed=N] [FILE ...]\n");
+    printf("    Round trips every file and N random lumps through both codecs and compares\n");
+    printf("    every encoder and decoder path with the reference decoders, then prints how\n");
+    printf("    fast each path went\n");
+}
+
+int main(int argc, char** argv)
+{
+    int random_lumps = 200;
+    std::vector<const char*> file_names;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strncmp(argv[i], "--random=", 9) && argv[i][9])
+        {
+            random_lumps = atoi(argv[i] + 9);
+        }
+        else if (!strncmp(argv[i], "--seed=", 7) && argv[i][7])
+        {
+            random_state = (unsigned int) strtoul(argv[i] + 7, NULL, 10);
+        }
+        else if (argv[i][0] == '-')
+        {
+            fuzz_help();
+            return EXIT_FAILURE;
+        }
+        else
+        {
+            file_names.push_back(argv[i]);
+        }
+    }
+
+    pathtiming_t timings[NUM_PATHS];
+    memset(timings, 0, sizeof(timings));
+
+    for (const char* file_name : file_names)
+    {
+        mappedfile_t file;
+        if (!map_file(file_name, &file))
+        {
+            printf("ERROR: Could not read %s!\n", file_name);
+            return EXIT_FAILURE;
+        }
+
+        check_input(file.data, file.size, timings);
+        unmap_file(&file);
+    }
+
+    for (int i = 0; i < random_lumps; ++i)
+    {
+        std::vector<byte> lump = make_lump();
+        check_input(lump.data(), lump.size(), timings);
+    }
+
+    printf("%zu files and %d random lumps came back the same on every path\n", file_names.size(), random_lumps);
+    printf("\n%-20s %12s %11s\n", "path", "bytes", "MB/s");
+    for (int i = 0; i < NUM_PATHS; ++i)
+    {
+        printf("%-20s %12lld %11.2f\n", path_names[i], timings[i].bytes,
+            (timings[i].seconds > 0) ? timings[i].bytes / timings[i].seconds / 1e6 : 0);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#include "wadutil64_def.h"
+
+// What the N64 pays for the work the profilers count. These are rough figures
+// for the game's decoders on the 93.75 MHz VR4300, taking in the cache misses
+// on RDRAM; they are good for ranking lumps against each other, not for timing one.
+#define CPU_HZ              93750000.0
+
+#define CYCLES_CODE_BIT     14      // one call to read and test a bit
+#define CYCLES_TREE_STEP    24      // load, compare and swap two node counts
+#define CYCLES_REBUILD      60000   // halving every count and rebuilding the tree
+#define CYCLES_FLAG_BYTE    8
+#define CYCLES_LITERAL      10
+#define CYCLES_MATCH        40      // working out where to copy from
+#define CYCLES_MATCH_BYTE   8
+
+// Cartridge reads as the game does them, in many small DMAs
+#define ROM_BYTES_PER_SECOND    5000000.0
+
+double decode_cycles(const decodecounts_t* counts)
+{
+    // The counts of the other codec are 0, so one sum does for both
+    return (double) counts->code_bits * CYCLES_CODE_BIT +
+        (double) counts->tree_steps * CYCLES_TREE_STEP +
+        (double) counts->rebuilds * CYCLES_REBUILD +
+        (double) counts->flag_bytes * CYCLES_FLAG_BYTE +
+        (double) counts->literals * CYCLES_LITERAL +
+        (double) counts->matches * CYCLES_MATCH +
+        (double) counts->match_bytes * CYCLES_MATCH_BYTE;
+}
+
+double cycles_to_ms(double cycles)
+{
+    return cycles * 1000 / CPU_HZ;
+}
+
+double rom_read_ms(int size)
+{
+    return size * 1000 / ROM_BYTES_PER_SECOND;
+}
+
+double load_ms(const decodecounts_t* counts, int rom_size)
+{
+    return rom_read_ms(rom_size) + cycles_to_ms(decode_cycles(counts));
+}
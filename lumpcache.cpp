@@ -0,0 +1,83 @@
+#include "wadutil64_def.h"
+
+// 64-bit FNV-1a
+unsigned long long hash_data(const byte* data, size_t size)
+{
+    unsigned long long hash = 0xCBF29CE484222325ULL;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+bool cache_open(const char* cache_dir)
+{
+    return make_directory(cache_dir);
+}
+
+// Everything the compressed data depends on is part of the file name
+static void cache_entry_name(char* entry_name, size_t entry_name_size, const char* cache_dir, const lumpkey_t* key)
+{
+    snprintf(entry_name, entry_name_size, "%s/%016llx-%x-%d-%d-v%d.lmp", cache_dir,
+        key->hash, key->size, key->codec, key->level, ENCODER_VERSION);
+}
+
+bool cache_load(const char* cache_dir, const lumpkey_t* key, std::vector<byte>* compressed)
+{
+    char entry_name[512];
+    cache_entry_name(entry_name, sizeof(entry_name), cache_dir, key);
+
+    FILE* entry = fopen(entry_name, "rb");
+    if (!entry)
+    {
+        return false;
+    }
+
+    fseek(entry, 0, SEEK_END);
+    long entry_size = ftell(entry);
+    fseek(entry, 0, SEEK_SET);
+
+    bool loaded = false;
+    if (entry_size > 0)
+    {
+        compressed->resize(entry_size);
+        loaded = fread(compressed->data(), entry_size, 1, entry) == 1;
+    }
+
+    fclose(entry);
+
+    if (!loaded)
+    {
+        compressed->clear();
+    }
+
+    return loaded;
+}
+
+void cache_store(const char* cache_dir, const lumpkey_t* key, const std::vector<byte>* compressed)
+{
+    char entry_name[512];
+    cache_entry_name(entry_name, sizeof(entry_name), cache_dir, key);
+
+    // Entries are written under a name of their own and then renamed, so other
+    // threads and other runs sharing the cache never see a partial one
+    char temp_name[560];
+    FILE* entry = create_temp_file(entry_name, temp_name, sizeof(temp_name));
+    if (!entry)
+    {
+        return;
+    }
+
+    bool written = fwrite(compressed->data(), compressed->size(), 1, entry) == 1;
+    written = (fclose(entry) == 0) && written;
+
+    // A failed store only costs a recompression next time
+    if (!written || rename(temp_name, entry_name) != 0)
+    {
+        remove(temp_name);
+    }
+}
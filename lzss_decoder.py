@@ -1,3 +1,9 @@
+# A textbook LZSS decoder for text with "<offset,length>" tokens, kept as an
+# illustration of the idea. It can't read the game's lumps: Jaguar lumps are
+# binary, with flag bytes and 2 byte matches, and D64 lumps are adaptive
+# Huffman. The reference decoders the codecs are checked against are the C++
+# ones in fuzz.cpp.
+
 encoding = "utf-8"
 
 def decode(text):
@@ -1,3 +1,8 @@
+# A textbook LZSS encoder that writes text with "<offset,length>" tokens, kept
+# as an illustration of the idea alongside lzss_decoder.py. Its output is not
+# a lump DecodeJaguar or DecodeD64 can read, EncodeJaguar and Deflate_Encode in
+# encodes.cpp are the encoders of the game's formats.
+
 
 def elements_in_array(check_elements, elements):
     i = 0
@@ -1,461 +1,1883 @@
-#include "wadutil64_def.h"
+#include "wadreader.h"
 
+// Modes combine into one pipeline, run in the order listed here
 typedef enum
 {
-    EXTRACT_MODE,
-    DECOMPRESS_MODE,
-    COMPRESS_MODE,
-    PAD_MODE
+    EXTRACT_MODE    = 1,
+    DECOMPRESS_MODE = 2,
+    PAD_MODE        = 4,
+    COMPRESS_MODE   = 8,
+    LUMP_MODE       = 16,   // single lumps out of a WAD, doesn't combine with the others
+    PROFILE_MODE    = 32    // estimated N64 load cost of every lump, writes nothing, doesn't combine either
 } wadutil64_mode;
 
-typedef enum
-{
-    DECODE_NONE,
-    DECODE_JAGUAR,
-    DECODE_D64
-} decodetype;
-
 typedef struct
 {
-    int         filepos;
-    int         size;
-    char        name[8];
-} lumpinfo_t;
+    int         num_threads;    // lumps processed at the same time
+    int         level;          // encodelevel for compression
+    const char* cache_dir;      // where compressed lumps are kept between runs, NULL for none
+    bool        stream;         // decompress lump by lump straight to the output file
+    const char* output_dir;     // where output files go, NULL for next to their input
+    statsreport_t* stats;       // per lump numbers, NULL unless --stats or --stats-json
+    bool        verify;         // decode every compressed lump again and compare it to the original
+    const std::vector<std::string>* lump_names;  // lumps -x writes out
+    const char* sidecar_file;   // decompressed lumps -d writes and -x reads, NULL for none
+    int         min_saving;     // percent a compressed lump has to save over storing it, or it is stored
+    bool        always_compress;    // compress every lump in a codec region, like the original tool
+    double      ms_per_kb;      // N64 load time a compressed lump may add per KB it saves, negative for any
+} options_t;
 
-typedef struct
-{
-    char        identification[4];      /* should be IWAD */
-    int         numlumps;
-    int         infotableofs;
-} wadinfo_t;
 
-static char input_file_name[128];
-static char output_file_name[128];
+void wadutil64_help()
+{
+    printf("Improper arguments!\n");
+    printf("USAGE:\n");
+    printf("    Extraction: wadutil64.exe -e DOOM64_ROM.z64 (.n64 and .v64 dumps work too)\n");
+    printf("    Decompression: wadutil64.exe -d DOOM64.WAD\n");
+    printf("    Compression: wadutil64.exe -c DOOM64.WAD\n");
+    printf("    Padding: wadutil64.exe -p DOOM64.WAD\n");
+    printf("    Single lumps: wadutil64.exe -x MAP17 [-x NAME ...] DOOM64.WAD, written as DOOM64_MAP17.lmp\n");
+    printf("    Load cost: wadutil64.exe --profile-load DOOM64.WAD ranks the lumps by estimated N64 load time\n");
+    printf("    Modes combine into one pass in the order extract/decompress, pad, compress,\n");
+    printf("    e.g. wadutil64.exe -e -p DOOM64_ROM.z64\n");
+    printf("    Batches: wadutil64.exe -d --out=DIR A.WAD B.WAD ... or --list=FILE with one name per line\n");
+    printf("OPTIONS:\n");
+    printf("    -j N: process lumps and files on N threads\n");
+    printf("    --level=fast|max: compression effort, max searches for the smallest output\n");
+    printf("    --cache=DIR: keep compressed lumps in DIR and reuse them for unchanged lumps\n");
+    printf("    --min-saving=PCT: store lumps as they are unless compression saves PCT percent, 0 by default\n");
+    printf("    --always-compress: compress every lump, even when that makes it larger\n");
+    printf("    --ms-per-kb=MS: store lumps as they are if decoding them on the N64 costs more than MS per KB saved\n");
+    printf("    --stream: decompress one lump at a time straight to the output file, in bounded memory\n");
+    printf("    --out=DIR: write the output files to DIR\n");
+    printf("    --list=FILE: also process the files listed in FILE\n");
+    printf("    --verify: check that every compressed lump decompresses back to the original\n");
+    printf("    --stats: print sizes and times of every lump at the end\n");
+    printf("    --stats-json=FILE: write them to FILE as JSON\n");
+    printf("    --sidecar=FILE: -d keeps the decompressed lumps in FILE, -x reads them from there\n");
+}
 
-void choose_decode_mode(byte* decode_mode, char* lump_name)
+// Offsets and sizes come straight from the file, a negative one turns into a
+// size_t larger than any file and fails the check like one past the end does
+const byte* lump_view(const mappedfile_t* WAD, size_t offset, size_t size)
 {
-    char MAP01_name[6] = "MAP01";
-    
-    if (!strcmp(lump_name, "S_START"))
+    if (offset > WAD->size || size > WAD->size - offset)
     {
-        *decode_mode = DECODE_JAGUAR;
+        printf("ERROR: WAD lump at %zu of size %zu lies outside of the file.", offset, size);
+        exit(EXIT_FAILURE);
     }
-    else if (!strcmp(lump_name, "T_START"))
+
+    return WAD->data + offset;
+}
+
+void read_wad_header(const mappedfile_t* WAD, wadinfo_t* wad_header)
+{
+    memcpy(wad_header, lump_view(WAD, 0, sizeof(wadinfo_t)), sizeof(wadinfo_t));
+}
+
+lumpinfo_t* read_lump_directory(const mappedfile_t* WAD, int number_of_lumps, int offset)
+{
+    // Checked before multiplying, a huge count would wrap around and pass the bounds check
+    if (number_of_lumps < 0 || offset < 0 || (size_t) offset > WAD->size ||
+        (size_t) number_of_lumps > (WAD->size - offset) / sizeof(lumpinfo_t))
     {
-        *decode_mode = DECODE_D64;
+        printf("ERROR: WAD directory of %i lumps at %i lies outside of the file.", number_of_lumps, offset);
+        exit(EXIT_FAILURE);
     }
-    else if (!strcmp(lump_name, "T_END"))
+
+    const byte* directory_data = lump_view(WAD, offset, number_of_lumps * sizeof(lumpinfo_t));
+
+    // Every mode rewrites the directory, so it gets its own copy
+    lumpinfo_t* lump_directory = (lumpinfo_t*) malloc(number_of_lumps * sizeof(lumpinfo_t));
+    if (!lump_directory)
     {
-        *decode_mode = DECODE_JAGUAR;
+        printf("ERROR: Could not read WAD lumps.");
+        exit(EXIT_FAILURE);
     }
-    else if (!strcmp(lump_name, MAP01_name))
+
+    memcpy(lump_directory, directory_data, number_of_lumps * sizeof(lumpinfo_t));
+
+    return lump_directory;
+}
+
+typedef struct
+{
+    byte*       base;
+    int         size;
+    int         used;
+} arena_t;
+
+void arena_init(arena_t* arena, int size)
+{
+    // Zeroed, so gaps and padding between lumps need no extra writes
+    arena->base = (byte*) calloc(size, 1);
+    if (!arena->base)
     {
-        *decode_mode = DECODE_D64;
+        printf("ERROR: Could not allocate %i bytes for the output WAD.", size);
+        exit(EXIT_FAILURE);
     }
 
-    MAP01_name[0] += 0x80;
-    if (!strcmp(lump_name, MAP01_name))
+    arena->size = size;
+    arena->used = 0;
+}
+
+byte* arena_alloc(arena_t* arena, int size)
+{
+    if (size < 0 || size > arena->size - arena->used)
     {
-        *decode_mode = DECODE_D64;
+        printf("ERROR: Output WAD is larger than planned.");
+        exit(EXIT_FAILURE);
     }
+
+    byte* block = arena->base + arena->used;
+    arena->used += size;
+
+    return block;
 }
 
-void wadutil64_help()
+void arena_free(arena_t* arena)
 {
-    printf("Improper arguments!\n");
-    printf("USAGE:\n");
-    printf("    Extraction: wadutil64.exe -e DOOM64_ROM.z64\n");
-    printf("    Decompression: wadutil64.exe -d DOOM64.WAD\n");
-    printf("    Compression: wadutil64.exe -c DOOM64.WAD\n");
-    printf("    Padding: wadutil64.exe -p DOOM64.WAD\n");
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
 }
 
-lumpinfo_t* read_lump_directory(FILE* WAD, int number_of_lumps, int offset)
+int round_up_4(int size)
 {
-    // Allocate space in memory for lump directory into
-    lumpinfo_t* lump_directory = (lumpinfo_t*) malloc(number_of_lumps * sizeof(lumpinfo_t));
-    if (!lump_directory)
+    return (size + 3) & ~3;
+}
+
+// Completes the image with the header and the directory after the last lump,
+// it is then a whole WAD to write out or to hand to the next mode
+void finish_WAD_image(arena_t* image, wadinfo_t* wad_header, lumpinfo_t* lump_directory)
+{
+    int directory_size = wad_header->numlumps * sizeof(lumpinfo_t);
+
+    wad_header->infotableofs = image->used;
+    memcpy(arena_alloc(image, directory_size), lump_directory, directory_size);
+    memcpy(image->base, wad_header, sizeof(wadinfo_t));
+}
+
+void init_lump_stats(lumpstats_t* stats, const mappedfile_t* input_WAD, const char* mode, const lumpinfo_t* lump_info, byte decode_mode, bool stored)
+{
+    memset(stats, 0, sizeof(lumpstats_t));
+    stats->file_name = input_WAD->name;
+    stats->mode = mode;
+    strncpy(stats->name, lump_info->name, 8);
+    stats->name[8] = 0;
+    stats->codec = decode_mode;
+    stats->stored = stored;
+}
+
+// The codecs return what went wrong instead of stopping the program, running out of memory still does
+bool codec_succeeded(wadutil64_status status)
+{
+    if (status == WADUTIL64_NO_MEMORY)
     {
-        printf("ERROR: Could not read WAD lumps.");
+        printf("ERROR: Out of memory!\n");
         exit(EXIT_FAILURE);
     }
 
-    // Read the lump directory
-    fseek(WAD, offset, SEEK_SET);
-    for (int i = 0; i < number_of_lumps; ++i)
+    return status == WADUTIL64_OK;
+}
+
+// Returns false if the lump data doesn't decode within the given sizes
+bool decompress_lump_data(const byte* lump_data, int lump_size, byte* output, int output_size, byte decode_mode)
+{
+    if (decode_mode == DECODE_NONE)
     {
-        fread(lump_directory + i, sizeof(lumpinfo_t), 1, WAD);
+        return true;
     }
 
-    return lump_directory;
+    return codec_succeeded(wadutil64_decode(decode_mode, lump_data, lump_size, output, output_size));
 }
 
-byte* read_lump(FILE* WAD, int offset, int size)
+// Counts the work decoding the lump takes, returns false like decompress_lump_data does
+bool profile_lump_data(const byte* lump_data, int lump_size, int output_size, byte decode_mode, decodecounts_t* counts)
 {
-    byte* lump_data = (byte*) malloc(size);
-    if (!lump_data)
+    if (decode_mode == DECODE_NONE)
     {
-        printf("ERROR: Could not read WAD lump at %i of size %i.", offset, size);
-        exit(EXIT_FAILURE);
+        memset(counts, 0, sizeof(decodecounts_t));
+        return true;
+    }
+
+    return codec_succeeded(wadutil64_profile(decode_mode, lump_data, lump_size, output_size, counts));
+}
+
+typedef struct
+{
+    const std::function<void(int)>* job;
+    int                 count;
+    int                 next_job;       // first unclaimed job, guarded by the pool lock
+    std::atomic<int>    finished_jobs;
+} jobbatch_t;
+
+// One set of threads for the whole run, shared by the lumps of every WAD
+typedef struct
+{
+    std::mutex                  lock;
+    std::condition_variable     wake;       // new jobs or a finished batch
+    std::vector<jobbatch_t*>    batches;    // the ones with unclaimed jobs left
+    std::vector<std::thread>    threads;
+    bool                        stopping;
+} jobpool_t;
+
+// Allocated and never destroyed, an exit() on an error while the threads still
+// run must not join them
+static jobpool_t& job_pool = *new jobpool_t;
+
+// Claims and runs a job of any batch, returns false if there was none
+bool run_one_job(std::unique_lock<std::mutex>& lock)
+{
+    if (job_pool.batches.empty())
+    {
+        return false;
+    }
+
+    // The newest batch first, so lumps of WADs already started go before new WADs
+    jobbatch_t* batch = job_pool.batches.back();
+    int i = batch->next_job++;
+    if (batch->next_job == batch->count)
+    {
+        job_pool.batches.pop_back();
     }
 
-    fseek(WAD, offset, SEEK_SET);
-    fread(lump_data, size, 1, WAD);
+    int count = batch->count;
+    lock.unlock();
+
+    (*batch->job)(i);
+
+    // The batch may be gone as soon as its last job is counted
+    bool last = (++batch->finished_jobs == count);
+
+    lock.lock();
+    if (last)
+    {
+        job_pool.wake.notify_all();
+    }
 
-    return lump_data;
+    return true;
 }
 
-void extract_WAD(FILE* input_ROM, FILE* output_WAD)
+void job_worker()
 {
-    printf("TODO: WAD EXTRACTION!!!\n");
+    std::unique_lock<std::mutex> lock(job_pool.lock);
+    while (!job_pool.stopping)
+    {
+        if (!run_one_job(lock))
+        {
+            job_pool.wake.wait(lock);
+        }
+    }
 }
 
-byte* decompress_lump_data(byte* lump_data, int new_size, byte decode_mode)
+void start_jobs(int num_threads)
 {
-    byte* decompressed_lump = (byte*) malloc(new_size);
-    if (!decompressed_lump)
+    job_pool.stopping = false;
+    for (int i = 1; i < num_threads; ++i)
     {
-        printf("ERROR: Could not decompress WAD lump.");
-        exit(EXIT_FAILURE);
+        job_pool.threads.emplace_back(job_worker);
+    }
+}
+
+void stop_jobs()
+{
+    {
+        std::lock_guard<std::mutex> lock(job_pool.lock);
+        job_pool.stopping = true;
+        job_pool.wake.notify_all();
+    }
+
+    for (std::thread& thread : job_pool.threads)
+    {
+        thread.join();
+    }
+    job_pool.threads.clear();
+}
+
+// Runs job(0) to job(count - 1) on the pool and returns when all are done.
+// The caller works on jobs too while it waits, so jobs may run jobs of their own.
+void run_jobs(int count, const std::function<void(int)>& job)
+{
+    if (count <= 0)
+    {
+        return;
     }
 
-    if (decode_mode == DECODE_JAGUAR)
+    jobbatch_t batch;
+    batch.job = &job;
+    batch.count = count;
+    batch.next_job = 0;
+    batch.finished_jobs = 0;
+
+    std::unique_lock<std::mutex> lock(job_pool.lock);
+    job_pool.batches.push_back(&batch);
+    job_pool.wake.notify_all();
+
+    while (batch.finished_jobs < count)
     {
-        DecodeJaguar(lump_data, decompressed_lump);
+        if (!run_one_job(lock))
+        {
+            job_pool.wake.wait(lock);
+        }
     }
-    else if (decode_mode == DECODE_D64)
+}
+
+typedef struct
+{
+    int         source_pos;     // where the lump starts in the input WAD
+    int         source_size;    // bytes the lump takes up in the input WAD
+    int         output_size;    // decompressed size, lump_info->size may be padded past it
+    byte        decode_mode;    // codec region the lump lies in
+    bool        compressed;
+} lumpplan_t;
+
+// Returns where the directory goes, right after the last decompressed lump.
+// With pad set every lump gets a slot rounded up to 4 bytes, the same
+// layout the padding mode would give the decompressed WAD.
+int plan_decompression(wadinfo_t* wad_header, lumpinfo_t* lump_directory, std::vector<lumpplan_t>* plan, bool pad)
+{
+    byte decode_mode = DECODE_NONE;
+    int output_pos = sizeof(wadinfo_t);
+
+    plan->resize(wad_header->numlumps);
+
+    for (int i = 0; i < wad_header->numlumps; ++i)
     {
-        DecodeD64(lump_data, decompressed_lump);
+        lumpinfo_t* lump_info = &(lump_directory[i]);
+
+        // Compressed lumps only store their compressed size implicitly,
+        // as the distance to the next lump (or the directory)
+        int next_pos = (i + 1 < wad_header->numlumps) ? lump_directory[i + 1].filepos : wad_header->infotableofs;
+
+        choose_decode_mode(&decode_mode, lump_info->name);
+        (*plan)[i].source_pos = lump_info->filepos;
+        (*plan)[i].source_size = next_pos - lump_info->filepos;
+        (*plan)[i].decode_mode = decode_mode;
+        (*plan)[i].compressed = (lump_info->name[0] & 0x80) != 0;
+        (*plan)[i].output_size = lump_info->size;
+
+        if ((*plan)[i].compressed)
+        {
+            lump_info->name[0] -= 0x80;
+        }
+
+        if (lump_info->size < 0 || lump_info->size > INT_MAX - 3 - output_pos)
+        {
+            printf("ERROR: Output WAD is larger than planned.");
+            exit(EXIT_FAILURE);
+        }
+
+        if (pad)
+        {
+            lump_info->size = round_up_4(lump_info->size);
+        }
+
+        // Decompressed lumps are laid out back to back
+        lump_info->filepos = output_pos;
+        output_pos += lump_info->size;
     }
 
-    free(lump_data);
-    return decompressed_lump;
+    return output_pos;
 }
 
-void decompress_and_write_lump(FILE* input_WAD, FILE* output_WAD, lumpinfo_t* lump_info, int size, byte* decode_mode)
+void decompress_lump(const mappedfile_t* input_WAD, arena_t* image, lumpinfo_t* lump_info, lumpplan_t* lump_plan, lumpstats_t* stats)
 {
-    choose_decode_mode(decode_mode, lump_info->name);
     // If empty marker lump, don't even bother and try to decompress
-    if (size <= 0)
+    if (lump_plan->source_size <= 0)
     {
         return;
     }
 
-    byte* lump_data = read_lump(input_WAD, lump_info->filepos, size);
+    byte* output = image->base + lump_info->filepos;
+    double start = stats_clock(stats);
 
-    if (lump_info->name[0] & 0x80)
+    if (lump_plan->compressed)
     {
-        lump_info->name[0] -= 0x80;
         char lump_name[9];
         strncpy(lump_name, lump_info->name, 8);
         lump_name[8] = 0;
         printf("Decompressing lump: %s\n", lump_name);
-        lump_data = decompress_lump_data(lump_data, lump_info->size, *decode_mode);
+
+        const byte* lump_data = lump_view(input_WAD, lump_plan->source_pos, lump_plan->source_size);
+        double read_end = stats_clock(stats);
+
+        // The slot is exactly the decompressed size, so a corrupt lump can't spill into its neighbours
+        if (!decompress_lump_data(lump_data, lump_plan->source_size, output, lump_plan->output_size, lump_plan->decode_mode))
+        {
+            printf("ERROR: Lump %s is corrupt, it doesn't decompress to its size of %i bytes.", lump_name, lump_plan->output_size);
+            exit(EXIT_FAILURE);
+        }
+
+        if (stats)
+        {
+            stats->read_seconds = read_end - start;
+            stats->code_seconds = stats_clock(stats) - read_end;
+        }
+    }
+    else
+    {
+        // Stored lumps are copied from the input as they are
+        memcpy(output, lump_view(input_WAD, lump_plan->source_pos, lump_plan->output_size), lump_plan->output_size);
+
+        if (stats)
+        {
+            stats->write_seconds = stats_clock(stats) - start;
+        }
+    }
+
+    if (stats)
+    {
+        stats->input_size = lump_plan->compressed ? lump_plan->source_size : lump_plan->output_size;
+        stats->output_size = lump_plan->output_size;
+    }
+}
+
+typedef struct
+{
+    FILE*       output_WAD;
+    int         written;
+    lumpstats_t* stats;
+} lumpstream_t;
+
+void write_to_stream(void* context, const byte* data, int size)
+{
+    lumpstream_t* stream = (lumpstream_t*) context;
+    double start = stats_clock(stream->stats);
+
+    fwrite(data, size, 1, stream->output_WAD);
+    stream->written += size;
+
+    if (stream->stats)
+    {
+        stream->stats->write_seconds += stats_clock(stream->stats) - start;
+    }
+}
+
+// Same output as through the image, but every lump goes out as it is decoded
+// and only the decoder's window is kept in memory
+void stream_WAD(const mappedfile_t* input_WAD, FILE* output_WAD, wadinfo_t* wad_header, lumpinfo_t* lump_directory, lumpplan_t* plan, int directory_pos, lumpstats_t* lump_stats)
+{
+    wad_header->infotableofs = directory_pos;
+    fwrite(wad_header, sizeof(wadinfo_t), 1, output_WAD);
+
+    for (int i = 0; i < wad_header->numlumps; ++i)
+    {
+        lumpinfo_t* lump_info = &(lump_directory[i]);
+        lumpplan_t* lump_plan = &(plan[i]);
+
+        lumpstream_t stream;
+        stream.output_WAD = output_WAD;
+        stream.written = 0;
+        stream.stats = lump_stats ? &(lump_stats[i]) : NULL;
+
+        double start = stats_clock(stream.stats);
+        double read_end = start;
+
+        // Empty marker lumps write nothing and are left as zeros like in the image
+        if (lump_plan->source_size > 0 && lump_plan->compressed)
+        {
+            char lump_name[9];
+            strncpy(lump_name, lump_info->name, 8);
+            lump_name[8] = 0;
+            printf("Decompressing lump: %s\n", lump_name);
+
+            const byte* lump_data = lump_view(input_WAD, lump_plan->source_pos, lump_plan->source_size);
+            read_end = stats_clock(stream.stats);
+
+            bool decoded = true;
+            if (lump_plan->decode_mode != DECODE_NONE)
+            {
+                decoded = codec_succeeded(wadutil64_decode_stream(lump_plan->decode_mode, lump_data, lump_plan->source_size,
+                    lump_plan->output_size, write_to_stream, &stream));
+            }
+
+            if (!decoded)
+            {
+                printf("ERROR: Lump %s is corrupt, it doesn't decompress to its size of %i bytes.", lump_name, lump_plan->output_size);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (lump_plan->source_size > 0)
+        {
+            write_to_stream(&stream, lump_view(input_WAD, lump_plan->source_pos, lump_plan->output_size), lump_plan->output_size);
+        }
+
+        // Lumps that decode short and padding are zero filled like in the image too
+        static const byte zeros[64] = { 0 };
+        for (int left = lump_info->size - stream.written; left > 0; left -= sizeof(zeros))
+        {
+            fwrite(zeros, (left < (int) sizeof(zeros)) ? left : sizeof(zeros), 1, output_WAD);
+        }
+
+        // The decoders pass their output on as they go, so writing is taken out of their time
+        if (stream.stats && lump_plan->source_size > 0)
+        {
+            stream.stats->read_seconds = read_end - start;
+            stream.stats->code_seconds = lump_plan->compressed ? stats_clock(stream.stats) - read_end - stream.stats->write_seconds : 0;
+            stream.stats->input_size = lump_plan->compressed ? lump_plan->source_size : lump_plan->output_size;
+            stream.stats->output_size = lump_plan->output_size;
+        }
+    }
+
+    fwrite(lump_directory, sizeof(lumpinfo_t), wad_header->numlumps, output_WAD);
+}
+
+// With --stream the lumps go straight to output_WAD if it is given, image is then left empty
+// Keeps the compressed lumps just decoded into image, so single lump reads find them later
+void write_sidecar(const mappedfile_t* input_WAD, arena_t* image, wadinfo_t* wad_header, lumpinfo_t* lump_directory, lumpplan_t* plan, unsigned long long directory_hash, const char* sidecar_file)
+{
+    sidecarinfo_t header;
+    header.numlumps = wad_header->numlumps;
+    header.directory_hash = directory_hash;
+
+    std::vector<sidecarlump_t> lumps;
+    std::vector<const byte*> lump_data;
+
+    for (int i = 0; i < wad_header->numlumps; ++i)
+    {
+        if (!plan[i].compressed || plan[i].source_size <= 0)
+        {
+            continue;
+        }
+
+        sidecarlump_t lump;
+        memset(&lump, 0, sizeof(sidecarlump_t));
+        lump.source_hash = hash_data(lump_view(input_WAD, plan[i].source_pos, plan[i].source_size), plan[i].source_size);
+        memcpy(lump.name, lump_directory[i].name, 8);
+        lump.lump = i;
+        lump.source_pos = plan[i].source_pos;
+        lump.source_size = plan[i].source_size;
+        lump.size = plan[i].output_size;
+
+        lumps.push_back(lump);
+        lump_data.push_back(image->base + lump_directory[i].filepos);
+    }
+
+    if (!sidecar_write(sidecar_file, &header, &lumps, &lump_data))
+    {
+        printf("ERROR: Could not write the sidecar %s!", sidecar_file);
+        exit(EXIT_FAILURE);
     }
 
-    fwrite(lump_data, lump_info->size, 1, output_WAD);
-    free(lump_data);
+    printf("Wrote %d decompressed lumps to %s\n", header.numentries, sidecar_file);
 }
 
-void decompress_WAD(FILE* input_WAD, FILE* output_WAD)
+void decompress_WAD(const mappedfile_t* input_WAD, arena_t* image, FILE* output_WAD, bool pad, const options_t* options)
 {
     // Read WAD header
     wadinfo_t wad_header;
-    fread(&wad_header, sizeof(wadinfo_t), 1, input_WAD);
-    printf("WAD name: %s\n", input_file_name);
+    read_wad_header(input_WAD, &wad_header);
+    printf("WAD name: %s\n", input_WAD->name);
     printf("Number of lumps: %d, Address to lump directory: %X\n", wad_header.numlumps, wad_header.infotableofs);
 
     // Read list of all lumps
     lumpinfo_t* lump_directory = read_lump_directory(input_WAD, wad_header.numlumps, wad_header.infotableofs);
 
-    fwrite(&wad_header, sizeof(wadinfo_t), 1, output_WAD);
-    int total_size = sizeof(wadinfo_t);
+    // The sidecar is tied to the directory as stored, the plan rewrites it
+    unsigned long long directory_hash = 0;
+    if (options->sidecar_file)
+    {
+        int directory_size = wad_header.numlumps * sizeof(lumpinfo_t);
+        directory_hash = hash_data(lump_view(input_WAD, wad_header.infotableofs, directory_size), directory_size);
+    }
 
-    byte decode_mode = DECODE_NONE;
+    // Resolve codecs and output offsets up front, so every lump can be
+    // decoded on its own, straight into its slot of the output image
+    std::vector<lumpplan_t> plan;
+    int directory_pos = plan_decompression(&wad_header, lump_directory, &plan, pad);
 
-    // Process first lump
+    std::vector<lumpstats_t> lump_stats;
+    if (options->stats)
     {
-        int lump_size = lump_directory[1].filepos - sizeof(wadinfo_t);
-        decompress_and_write_lump(input_WAD, output_WAD, &(lump_directory[0]), lump_size, &decode_mode);
-
-        lump_directory[0].filepos = sizeof(wadinfo_t);
-        total_size += lump_directory[0].size;
+        lump_stats.resize(wad_header.numlumps);
+        for (int i = 0; i < wad_header.numlumps; ++i)
+        {
+            init_lump_stats(&(lump_stats[i]), input_WAD, "decompress", &(lump_directory[i]), plan[i].decode_mode, !plan[i].compressed);
+        }
     }
-    
-    // Process all other lumps except the last one
-    for (int i = 1; i < wad_header.numlumps - 1; ++i)
+
+    lumpstats_t* stats = options->stats ? lump_stats.data() : NULL;
+
+    if (options->stream && output_WAD)
     {
-        int lump_size = lump_directory[i+1].filepos - lump_directory[i].filepos;
-        decompress_and_write_lump(input_WAD, output_WAD, &(lump_directory[i]), lump_size, &decode_mode);
+        stream_WAD(input_WAD, output_WAD, &wad_header, lump_directory, plan.data(), directory_pos, stats);
+        if (stats)
+        {
+            stats_add_lumps(options->stats, &lump_stats);
+        }
+        free(lump_directory);
+        return;
+    }
 
-        lump_directory[i].filepos = lump_directory[i - 1].filepos + lump_directory[i - 1].size;
-        total_size += lump_directory[i].size;
+    // Size the image from the uncompressed sizes, with room to keep every lump 4 byte aligned
+    int total_size = sizeof(wadinfo_t) + wad_header.numlumps * sizeof(lumpinfo_t);
+    for (int i = 0; i < wad_header.numlumps; ++i)
+    {
+        total_size += round_up_4(lump_directory[i].size);
     }
-    
-    // Process last lump
+
+    arena_init(image, total_size);
+    arena_alloc(image, directory_pos);
+
+    run_jobs(wad_header.numlumps, [&](int i)
     {
-        int lump_size = wad_header.infotableofs - lump_directory[wad_header.numlumps - 1].filepos;
-        decompress_and_write_lump(input_WAD, output_WAD, &(lump_directory[wad_header.numlumps - 1]), lump_size, &decode_mode);
+        decompress_lump(input_WAD, image, &(lump_directory[i]), &(plan[i]), stats ? &(stats[i]) : NULL);
+    });
 
-        lump_directory[wad_header.numlumps - 1].filepos = lump_directory[wad_header.numlumps - 2].filepos + lump_directory[wad_header.numlumps - 2].size;
-        total_size += lump_directory[wad_header.numlumps - 1].size;
+    if (options->sidecar_file)
+    {
+        write_sidecar(input_WAD, image, &wad_header, lump_directory, plan.data(), directory_hash, options->sidecar_file);
     }
 
-    // Write lump directory
-    fwrite(lump_directory, sizeof(lumpinfo_t), wad_header.numlumps, output_WAD);
+    finish_WAD_image(image, &wad_header, lump_directory);
 
-    // Fix header using new size of WAD
-    wad_header.infotableofs = total_size;
-    fseek(output_WAD, 0, SEEK_SET);
-    fwrite(&wad_header, sizeof(wadinfo_t), 1, output_WAD);
+    if (stats)
+    {
+        stats_add_lumps(options->stats, &lump_stats);
+    }
 
     free(lump_directory);
 }
 
-int compress_and_write_lump(FILE* input_WAD, FILE* output_WAD, lumpinfo_t* lump_info, byte* decode_mode)
+// ROM dumps come in three byte orders, a byte at offset i of the big endian
+// (.z64) image sits at offset i ^ swizzle of the dump
+int detect_ROM_swizzle(const mappedfile_t* input_ROM)
 {
-    choose_decode_mode(decode_mode, lump_info->name);
-    // If empty marker lump, don't even bother and try to decompress
-    if (lump_info->size <= 0)
+    static const byte z64_magic[4] = { 0x80, 0x37, 0x12, 0x40 };
+    static const byte v64_magic[4] = { 0x37, 0x80, 0x40, 0x12 };
+    static const byte n64_magic[4] = { 0x40, 0x12, 0x37, 0x80 };
+
+    int swizzle = -1;
+    if (input_ROM->size >= 4)
     {
-        return 0;
+        if (!memcmp(input_ROM->data, z64_magic, 4))
+        {
+            swizzle = 0;
+        }
+        else if (!memcmp(input_ROM->data, v64_magic, 4))
+        {
+            swizzle = 1;
+        }
+        else if (!memcmp(input_ROM->data, n64_magic, 4))
+        {
+            swizzle = 3;
+        }
     }
 
-    byte* lump_data = read_lump(input_WAD, lump_info->filepos, lump_info->size);
-    bool can_free = true;
-    int lump_size = lump_info->size;
-    std::vector<byte> compressed_lump_data;
-    
-    if (*decode_mode == DECODE_JAGUAR)
+    // Swapped words must be whole, or the last bytes would map outside of the dump
+    if (swizzle < 0 || (input_ROM->size & swizzle) != 0)
     {
-        // TODO: implement Jaguar Doom's compression (should be standard LZSS)
+        printf("ERROR: %s is not a N64 ROM image.", input_ROM->name);
+        exit(EXIT_FAILURE);
     }
-    else if (*decode_mode == DECODE_D64)
+
+    return swizzle;
+}
+
+// Copies bytes of the big endian image, undoing the byte order of the dump on the way
+void read_ROM(const mappedfile_t* input_ROM, int swizzle, size_t offset, size_t size, byte* output)
+{
+    if (swizzle == 0)
     {
-        char lump_name[9];
-        strncpy(lump_name, lump_info->name, 8);
-        lump_name[8] = 0;
-        printf("Compressing lump: %s\n", lump_name);
+        memcpy(output, input_ROM->data + offset, size);
+        return;
+    }
 
-        lump_info->name[0] += 0x80;
-        compressed_lump_data = Deflate_Encode(lump_data, lump_info->size);
-        lump_size = static_cast<int>(compressed_lump_data.size());
-        lump_data = compressed_lump_data.data();
-        can_free = false;
+    for (size_t i = 0; i < size; ++i)
+    {
+        output[i] = input_ROM->data[(offset + i) ^ swizzle];
     }
-    
-    fwrite(lump_data, lump_size, 1, output_WAD);
-    if (can_free)
+}
+
+size_t find_IWAD_signature(const byte* data, size_t size)
+{
+    // memchr skips ahead to candidates much faster than comparing at every offset
+    for (size_t pos = 0; pos + 4 <= size; ++pos)
     {
-        free(lump_data);
+        const byte* candidate = (const byte*) memchr(data + pos, 'I', size - 3 - pos);
+        if (!candidate)
+        {
+            break;
+        }
+
+        pos = candidate - data;
+        if (!memcmp(candidate, "IWAD", 4))
+        {
+            return pos;
+        }
     }
 
-    return lump_size;
+    return size;
 }
 
-void compress_WAD(FILE* input_WAD, FILE* output_WAD)
+#define ROM_SCAN_CHUNK_SIZE 0x10000
+
+// Finds the next IWAD signature at or after start, in big endian offsets
+size_t scan_ROM(const mappedfile_t* input_ROM, int swizzle, size_t start)
 {
-    // Read WAD header
-    wadinfo_t wad_header;
-    fread(&wad_header, sizeof(wadinfo_t), 1, input_WAD);
-    printf("WAD name: %s\n", input_file_name);
-    printf("Number of lumps: %d, Address to lump directory: %X\n", wad_header.numlumps, wad_header.infotableofs);
+    if (swizzle == 0)
+    {
+        return start + find_IWAD_signature(input_ROM->data + start, input_ROM->size - start);
+    }
 
-    // Read list of all lumps
-    lumpinfo_t* lump_directory = read_lump_directory(input_WAD, wad_header.numlumps, wad_header.infotableofs);
+    // Swapped dumps are put in order a chunk at a time, chunks overlap so
+    // signatures crossing a chunk boundary are still found
+    byte chunk[ROM_SCAN_CHUNK_SIZE];
+    while (start + 4 <= input_ROM->size)
+    {
+        size_t chunk_size = std::min((size_t) ROM_SCAN_CHUNK_SIZE, input_ROM->size - start);
+        read_ROM(input_ROM, swizzle, start, chunk_size, chunk);
 
-    fwrite(&wad_header, sizeof(wadinfo_t), 1, output_WAD);
-    int total_size = sizeof(wadinfo_t);
+        size_t pos = find_IWAD_signature(chunk, chunk_size);
+        if (pos < chunk_size)
+        {
+            return start + pos;
+        }
 
-    byte decode_mode = DECODE_NONE;
+        start += chunk_size - 3;
+    }
+
+    return input_ROM->size;
+}
 
-    // Process first lump
+// The signature alone also turns up in code and text, so only accept it
+// with a header and directory that make sense for the rest of the ROM
+bool validate_WAD(const mappedfile_t* input_ROM, int swizzle, size_t offset, size_t* WAD_size)
+{
+    size_t space = input_ROM->size - offset;
+    if (space < sizeof(wadinfo_t))
     {
-        total_size += compress_and_write_lump(input_WAD, output_WAD, &(lump_directory[0]), &decode_mode);
-        lump_directory[0].filepos = sizeof(wadinfo_t);
+        return false;
     }
-    
-    // Process all other lumps
-    for (int i = 1; i < wad_header.numlumps; ++i)
+
+    wadinfo_t wad_header;
+    read_ROM(input_ROM, swizzle, offset, sizeof(wadinfo_t), (byte*) &wad_header);
+
+    if (wad_header.numlumps <= 0 || wad_header.infotableofs < (int) sizeof(wadinfo_t))
     {
-        int compressed_size = compress_and_write_lump(input_WAD, output_WAD, &(lump_directory[i]), &decode_mode);
-        lump_directory[i].filepos = total_size;
-        total_size += compressed_size;
+        return false;
     }
 
-    // Write lump directory
-    fwrite(lump_directory, sizeof(lumpinfo_t), wad_header.numlumps, output_WAD);
+    // The directory closes the WAD
+    size_t directory_end = (size_t) wad_header.infotableofs + (size_t) wad_header.numlumps * sizeof(lumpinfo_t);
+    if (directory_end > space || directory_end > INT_MAX)
+    {
+        return false;
+    }
 
-    // Fix header using new size of WAD
-    wad_header.infotableofs = total_size;
-    fseek(output_WAD, 0, SEEK_SET);
-    fwrite(&wad_header, sizeof(wadinfo_t), 1, output_WAD);
+    for (int i = 0; i < wad_header.numlumps; ++i)
+    {
+        lumpinfo_t lump_info;
+        read_ROM(input_ROM, swizzle, offset + wad_header.infotableofs + i * sizeof(lumpinfo_t), sizeof(lumpinfo_t), (byte*) &lump_info);
+
+        if (lump_info.filepos < 0 || lump_info.filepos > wad_header.infotableofs || lump_info.size < 0)
+        {
+            return false;
+        }
+
+        // Only stored lumps have their size in the file, compressed ones record the decompressed size
+        bool compressed = (lump_info.name[0] & 0x80) != 0;
+        if (!compressed && lump_info.size > wad_header.infotableofs - lump_info.filepos)
+        {
+            return false;
+        }
+    }
 
-    free(lump_directory);
+    *WAD_size = directory_end;
+    return true;
 }
 
-byte* pad_lump(FILE* WAD, lumpinfo_t* lump_info)
+void extract_WAD(const mappedfile_t* input_ROM, arena_t* image, FILE* output_WAD, bool pad, const options_t* options)
 {
-    int mod = lump_info->size % 4;
-    int padding = (mod != 0) ? 4 - mod : 0;
+    int swizzle = detect_ROM_swizzle(input_ROM);
 
-    byte* lump_data = read_lump(WAD, lump_info->filepos, lump_info->size);
+    size_t WAD_offset = 0;
+    size_t WAD_size = 0;
+    for (WAD_offset = scan_ROM(input_ROM, swizzle, 0); WAD_offset < input_ROM->size; WAD_offset = scan_ROM(input_ROM, swizzle, WAD_offset + 1))
+    {
+        if (validate_WAD(input_ROM, swizzle, WAD_offset, &WAD_size))
+        {
+            break;
+        }
+    }
 
-    if (padding > 0)
+    if (WAD_offset >= input_ROM->size)
     {
-        // Calculate new size
-        int padded_size = lump_info->size + padding;
-        
-        // Copy lump data with padding
-        byte* padded_lump_data = (byte*) malloc(padded_size);
-        memset(padded_lump_data, 0, padded_size);
-        memcpy(padded_lump_data, lump_data, lump_info->size);
+        printf("ERROR: Could not find a WAD in %s.", input_ROM->name);
+        exit(EXIT_FAILURE);
+    }
 
-        // Fix entry in lump directory
-        lump_info->size = padded_size;
+    printf("Found WAD at ROM address %zX, size %zX\n", WAD_offset, WAD_size);
 
-        free(lump_data);
-        lump_data = padded_lump_data;
+    // Big endian dumps are used in place, swapped ones only get the WAD put back in order
+    mappedfile_t input_WAD;
+    byte* swapped_WAD = NULL;
+    if (swizzle == 0)
+    {
+        input_WAD.data = input_ROM->data + WAD_offset;
+    }
+    else
+    {
+        swapped_WAD = (byte*) malloc(WAD_size);
+        if (!swapped_WAD)
+        {
+            printf("ERROR: Could not allocate %zu bytes for the WAD.", WAD_size);
+            exit(EXIT_FAILURE);
+        }
+
+        read_ROM(input_ROM, swizzle, WAD_offset, WAD_size, swapped_WAD);
+        input_WAD.data = swapped_WAD;
     }
+    input_WAD.size = WAD_size;
+    input_WAD.name = input_ROM->name;
 
-    return lump_data;
+    decompress_WAD(&input_WAD, image, output_WAD, pad, options);
+
+    free(swapped_WAD);
 }
 
-void pad_WAD(FILE* input_WAD, FILE* output_WAD)
+typedef struct
 {
-    // Read WAD header
-    wadinfo_t wad_header;
-    fread(&wad_header, sizeof(wadinfo_t), 1, input_WAD);
-    printf("WAD name: %s\n", input_file_name);
-    printf("Number of lumps: %d, Address to lump directory: %X\n", wad_header.numlumps, wad_header.infotableofs);
+    const byte*         data;           // lump as mapped from the input WAD
+    byte                decode_mode;    // codec region the lump lies in
+    std::vector<byte>   compressed;     // encoded lump, empty if stored as is
+    bool                cached;         // compressed data came from the cache
+    lumpstats_t*        stats;          // NULL unless stats are kept
+    int                 mismatch;       // first byte that doesn't decode back, -1 if all do
+} lumpjob_t;
 
-    // Read list of all lumps
-    lumpinfo_t* lump_directory = read_lump_directory(input_WAD, wad_header.numlumps, wad_header.infotableofs);
+typedef struct
+{
+    const byte* original;
+    int         size;
+    int         checked;
+    int         mismatch;
+} lumpcheck_t;
 
-    fwrite(&wad_header, sizeof(wadinfo_t), 1, output_WAD);
-    int total_size = sizeof(wadinfo_t);
+void compare_with_original(void* context, const byte* data, int size)
+{
+    lumpcheck_t* check = (lumpcheck_t*) context;
 
-    // Pad first lump
+    for (int i = 0; i < size && check->mismatch < 0; ++i)
     {
-        byte* lump_data = pad_lump(input_WAD, &(lump_directory[0]));
+        if (check->checked + i >= check->size || data[i] != check->original[check->checked + i])
+        {
+            check->mismatch = check->checked + i;
+        }
+    }
 
-        lump_directory[0].filepos = sizeof(wadinfo_t);
-        total_size += lump_directory[0].size;
+    check->checked += size;
+}
 
-        fwrite(lump_data, lump_directory[0].size, 1, output_WAD);
-        free(lump_data);
-    }
+// Returns the first byte of the lump that doesn't come back from its compressed data, -1 if none.
+// The decoders pass their output straight on for comparing, it is never stored.
+int verify_lump(const byte* lump_data, int lump_size, const std::vector<byte>* compressed, byte decode_mode)
+{
+    lumpcheck_t check;
+    check.original = lump_data;
+    check.size = lump_size;
+    check.checked = 0;
+    check.mismatch = -1;
+
+    bool decoded = codec_succeeded(wadutil64_decode_stream(decode_mode, compressed->data(), compressed->size(), lump_size,
+        compare_with_original, &check));
 
-    for (int i = 1; i < wad_header.numlumps; ++i)
+    // Decoding stops early on bad data, or the data may end before the lump does
+    if ((!decoded || check.checked < lump_size) && check.mismatch < 0)
     {
-        byte* lump_data = pad_lump(input_WAD, &(lump_directory[i]));
+        check.mismatch = check.checked;
+    }
 
-        lump_directory[i].filepos = lump_directory[i - 1].filepos + lump_directory[i - 1].size;
-        total_size += lump_directory[i].size;
+    return check.mismatch;
+}
 
-        fwrite(lump_data, lump_directory[i].size, 1, output_WAD);
-        free(lump_data);
+// Whether the time the N64 spends decoding the lump, less the time it saves reading fewer bytes
+// off the cartridge, is at most ms_per_kb for every KB the codec saves
+bool pays_for_load(const lumpinfo_t* lump_info, const lumpjob_t* lump, double ms_per_kb)
+{
+    if (ms_per_kb < 0)
+    {
+        return true;
     }
 
-    // Write lump directory
-    fwrite(lump_directory, sizeof(lumpinfo_t), wad_header.numlumps, output_WAD);
+    decodecounts_t counts;
+    int compressed_size = static_cast<int>(lump->compressed.size());
+    if (!profile_lump_data(lump->compressed.data(), compressed_size, lump_info->size, lump->decode_mode, &counts))
+    {
+        return false;
+    }
 
-    // Fix header using new size of WAD
-    wad_header.infotableofs = total_size;
-    fseek(output_WAD, 0, SEEK_SET);
-    fwrite(&wad_header, sizeof(wadinfo_t), 1, output_WAD);
+    int raw_size = round_up_4(lump_info->size);
+    double added_ms = load_ms(&counts, compressed_size) - rom_read_ms(raw_size);
+    return added_ms <= ms_per_kb * (raw_size - compressed_size) / 1024;
+}
 
-    free(lump_directory);
+// Flags the lump as compressed if its encoded data is within budget and quick enough to load,
+// else drops the data so it is stored
+void keep_compressed(lumpinfo_t* lump_info, lumpjob_t* lump, int budget, double ms_per_kb)
+{
+    if (lump->compressed.empty() || static_cast<int>(lump->compressed.size()) > budget ||
+        !pays_for_load(lump_info, lump, ms_per_kb))
+    {
+        lump->compressed.clear();
+        lump->mismatch = -1;
+        if (lump->stats)
+        {
+            lump->stats->stored = true;
+        }
+        return;
+    }
+
+    lump_info->name[0] += 0x80;
 }
 
-int main(int argc, char** argv)
+void compress_lump(lumpinfo_t* lump_info, lumpjob_t* lump, const options_t* options)
 {
-    std::ios::sync_with_stdio(false);
+    // If empty marker lump, don't even bother and try to compress
+    if (lump_info->size <= 0)
+    {
+        return;
+    }
 
-    if (argc != 3)
+    // Lumps before the first marker are stored as they are
+    if (lump->decode_mode == DECODE_NONE)
     {
-        wadutil64_help();
-        return EXIT_FAILURE;
+        return;
     }
 
-    // Open input file
-    strncpy(input_file_name, argv[2], 128);
-    FILE* input_file = fopen(input_file_name, "rb");
-    if (!input_file)
+    char lump_name[9];
+    strncpy(lump_name, lump_info->name, 8);
+    lump_name[8] = 0;
+
+    // The codec has to save something over storing the lump as it is, which
+    // also decodes fastest. Stored lumps keep a slot rounded up to 4 bytes,
+    // like the encoders' output, so that is what the codec is up against.
+    int budget = INT_MAX;
+    if (!options->always_compress)
     {
-        printf("ERROR: Input file %s not found!\n", input_file_name);
-        return EXIT_FAILURE;
+        budget = static_cast<int>((long long) round_up_4(lump_info->size) * (100 - options->min_saving) / 100) - 1;
     }
 
-    // Modify output file name
-    strncpy(output_file_name, input_file_name, 128);
-    output_file_name[strlen(output_file_name) - 4] = 0;
+    lumpstats_t* stats = lump->stats;
+    double start = stats_clock(stats);
 
-    byte program_mode;
-    char program_mode_user_input = argv[1][1];
-    switch (program_mode_user_input)
+    lumpkey_t key;
+    if (options->cache_dir)
     {
-    case 'e':
-        program_mode = EXTRACT_MODE;
-        strcat(output_file_name, "_extract.WAD");
-        printf("Extraction mode enabled!\n");
-        break;
+        key.hash = hash_data(lump->data, lump_info->size);
+        key.size = lump_info->size;
+        key.codec = lump->decode_mode;
+        key.level = options->level;
+
+        if (cache_load(options->cache_dir, &key, &(lump->compressed)))
+        {
+            printf("Reusing cached lump: %s\n", lump_name);
+            lump->cached = true;
+
+            if (stats)
+            {
+                stats->read_seconds = stats_clock(stats) - start;
+            }
+
+            // Cached lumps are checked too, they may have been written by an older build
+            double verify_start = stats_clock(stats);
+            if (options->verify)
+            {
+                lump->mismatch = verify_lump(lump->data, lump_info->size, &(lump->compressed), lump->decode_mode);
+            }
+
+            double keep_start = stats_clock(stats);
+            keep_compressed(lump_info, lump, budget, options->ms_per_kb);
+
+            if (stats)
+            {
+                stats->verify_seconds = keep_start - verify_start;
+                stats->code_seconds = stats_clock(stats) - keep_start;
+            }
+            return;
+        }
+    }
+
+    printf("Compressing lump: %s\n", lump_name);
+    double read_end = stats_clock(stats);
+
+    // The encoders stop as soon as they are past the budget, only --always-compress
+    // has no budget and needs room for what lumps that don't compress grow to
+    int capacity = std::max(0, std::min(budget, lump_info->size + lump_info->size / 4 + 64));
+    size_t compressed_size = 0;
+    wadutil64_status status;
+    do
+    {
+        lump->compressed.resize(capacity);
+        status = wadutil64_encode(lump->decode_mode, options->level, lump->data, lump_info->size,
+            lump->compressed.data(), lump->compressed.size(), &compressed_size);
+        capacity = (capacity < budget / 2) ? capacity * 2 : budget;
+    } while (status == WADUTIL64_TOO_LARGE && static_cast<int>(lump->compressed.size()) < budget);
+
+    codec_succeeded(status);
+    lump->compressed.resize(compressed_size);
+
+    double code_end = stats_clock(stats);
+
+    // Checked right away on this thread while the other threads go on encoding,
+    // a lump that doesn't come back doesn't go into the cache either
+    if (options->verify && !lump->compressed.empty())
+    {
+        lump->mismatch = verify_lump(lump->data, lump_info->size, &(lump->compressed), lump->decode_mode);
+    }
+
+    double verify_end = stats_clock(stats);
+
+    if (options->cache_dir && lump->mismatch < 0 && !lump->compressed.empty())
+    {
+        cache_store(options->cache_dir, &key, &(lump->compressed));
+    }
+
+    double write_end = stats_clock(stats);
+
+    keep_compressed(lump_info, lump, budget, options->ms_per_kb);
+
+    if (stats)
+    {
+        stats->read_seconds = read_end - start;
+        stats->code_seconds = (code_end - read_end) + (stats_clock(stats) - write_end);
+        stats->verify_seconds = verify_end - code_end;
+        stats->write_seconds = write_end - verify_end;
+    }
+}
+
+// Bytes a lump stored as it is takes up, the ones the codec didn't pay off for
+// keep the next lump 4 byte aligned like compressed ones do
+int stored_size(const lumpinfo_t* lump_info, const lumpjob_t* lump)
+{
+    int size = std::max(lump_info->size, 0);
+    return (lump->decode_mode != DECODE_NONE) ? round_up_4(size) : size;
+}
+
+void compress_WAD(const mappedfile_t* input_WAD, arena_t* image, const options_t* options)
+{
+    // Read WAD header
+    wadinfo_t wad_header;
+    read_wad_header(input_WAD, &wad_header);
+    printf("WAD name: %s\n", input_WAD->name);
+    printf("Number of lumps: %d, Address to lump directory: %X\n", wad_header.numlumps, wad_header.infotableofs);
+
+    // Read list of all lumps
+    lumpinfo_t* lump_directory = read_lump_directory(input_WAD, wad_header.numlumps, wad_header.infotableofs);
+
+    // Find the data of all lumps and which codec each one needs
+    std::vector<lumpjob_t> lumps(wad_header.numlumps);
+    byte decode_mode = DECODE_NONE;
+
+    std::vector<lumpstats_t> lump_stats(options->stats ? wad_header.numlumps : 0);
+
+    for (int i = 0; i < wad_header.numlumps; ++i)
+    {
+        choose_decode_mode(&decode_mode, lump_directory[i].name);
+        lumps[i].decode_mode = decode_mode;
+        lumps[i].data = NULL;
+        lumps[i].cached = false;
+        lumps[i].stats = NULL;
+        lumps[i].mismatch = -1;
+
+        if (options->stats)
+        {
+            lumps[i].stats = &(lump_stats[i]);
+            init_lump_stats(lumps[i].stats, input_WAD, "compress", &(lump_directory[i]), decode_mode, decode_mode == DECODE_NONE);
+        }
+
+        if (lump_directory[i].size > 0)
+        {
+            lumps[i].data = lump_view(input_WAD, lump_directory[i].filepos, lump_directory[i].size);
+        }
+    }
+
+    // Lumps don't share any encoder state, so they can be compressed in any order
+    run_jobs(wad_header.numlumps, [&](int i)
+    {
+        compress_lump(&(lump_directory[i]), &(lumps[i]), options);
+    });
+
+    if (options->cache_dir)
+    {
+        int cached_lumps = 0;
+        int compressed_lumps = 0;
+        for (int i = 0; i < wad_header.numlumps; ++i)
+        {
+            cached_lumps += lumps[i].cached;
+            compressed_lumps += !lumps[i].compressed.empty();
+        }
+
+        printf("Reused %d of %d compressed lumps from the cache\n", cached_lumps, compressed_lumps);
+    }
+
+    int stored_lumps = 0;
+    for (int i = 0; i < wad_header.numlumps; ++i)
+    {
+        stored_lumps += lumps[i].decode_mode != DECODE_NONE && lump_directory[i].size > 0 && lumps[i].compressed.empty();
+    }
+
+    if (stored_lumps)
+    {
+        printf("Stored %d lumps as they are, compressing them didn't pay off\n", stored_lumps);
+    }
+
+    if (options->verify)
+    {
+        int failed_lumps = 0;
+        for (int i = 0; i < wad_header.numlumps; ++i)
+        {
+            if (lumps[i].mismatch >= 0)
+            {
+                char lump_name[9];
+                strncpy(lump_name, lump_directory[i].name, 8);
+                lump_name[0] &= 0x7F;
+                lump_name[8] = 0;
+                printf("ERROR: Lump %s doesn't decompress back to the original, first wrong byte is %i of %i.\n",
+                    lump_name, lumps[i].mismatch, lump_directory[i].size);
+                failed_lumps++;
+            }
+        }
+
+        if (failed_lumps)
+        {
+            printf("ERROR: %d lumps of %s failed verification.", failed_lumps, input_WAD->name);
+            exit(EXIT_FAILURE);
+        }
+
+        printf("Verified all compressed lumps of %s\n", input_WAD->name);
+    }
+
+    // The final size of every lump is known now
+    int total_size = sizeof(wadinfo_t) + wad_header.numlumps * sizeof(lumpinfo_t);
+    for (int i = 0; i < wad_header.numlumps; ++i)
+    {
+        total_size += lumps[i].compressed.empty() ? stored_size(&(lump_directory[i]), &(lumps[i])) : static_cast<int>(lumps[i].compressed.size());
+    }
+
+    arena_init(image, total_size);
+    arena_alloc(image, sizeof(wadinfo_t));
+
+    // Lay out lumps in directory order
+    for (int i = 0; i < wad_header.numlumps; ++i)
+    {
+        lumpstats_t* stats = lumps[i].stats;
+        double start = stats_clock(stats);
+
+        lump_directory[i].filepos = image->used;
+
+        if (!lumps[i].compressed.empty())
+        {
+            int lump_size = static_cast<int>(lumps[i].compressed.size());
+            memcpy(arena_alloc(image, lump_size), lumps[i].compressed.data(), lump_size);
+        }
+        else if (lump_directory[i].size > 0)
+        {
+            memcpy(arena_alloc(image, stored_size(&(lump_directory[i]), &(lumps[i]))), lumps[i].data, lump_directory[i].size);
+        }
+
+        if (stats)
+        {
+            stats->input_size = std::max(lump_directory[i].size, 0);
+            stats->output_size = lumps[i].compressed.empty() ? stats->input_size : static_cast<int>(lumps[i].compressed.size());
+            stats->write_seconds += stats_clock(stats) - start;
+        }
+    }
+
+    finish_WAD_image(image, &wad_header, lump_directory);
+
+    if (options->stats)
+    {
+        stats_add_lumps(options->stats, &lump_stats);
+    }
+
+    free(lump_directory);
+}
+
+void pad_lump(const mappedfile_t* input_WAD, arena_t* image, lumpinfo_t* lump_info)
+{
+    const byte* lump_data = lump_view(input_WAD, lump_info->filepos, lump_info->size);
+    int padded_size = round_up_4(lump_info->size);
+
+    // The padding bytes of the slot are already zero
+    byte* padded_lump_data = arena_alloc(image, padded_size);
+    memcpy(padded_lump_data, lump_data, lump_info->size);
+
+    // Fix entry in lump directory
+    lump_info->filepos = static_cast<int>(padded_lump_data - image->base);
+    lump_info->size = padded_size;
+}
+
+void pad_WAD(const mappedfile_t* input_WAD, arena_t* image)
+{
+    // Read WAD header
+    wadinfo_t wad_header;
+    read_wad_header(input_WAD, &wad_header);
+    printf("WAD name: %s\n", input_WAD->name);
+    printf("Number of lumps: %d, Address to lump directory: %X\n", wad_header.numlumps, wad_header.infotableofs);
+
+    // Read list of all lumps
+    lumpinfo_t* lump_directory = read_lump_directory(input_WAD, wad_header.numlumps, wad_header.infotableofs);
+
+    int total_size = sizeof(wadinfo_t) + wad_header.numlumps * sizeof(lumpinfo_t);
+    for (int i = 0; i < wad_header.numlumps; ++i)
+    {
+        total_size += round_up_4(lump_directory[i].size);
+    }
+
+    arena_init(image, total_size);
+    arena_alloc(image, sizeof(wadinfo_t));
+
+    for (int i = 0; i < wad_header.numlumps; ++i)
+    {
+        pad_lump(input_WAD, image, &(lump_directory[i]));
+    }
+
+    finish_WAD_image(image, &wad_header, lump_directory);
+
+    free(lump_directory);
+}
+
+int parse_mode(const char* arg)
+{
+    if (arg[0] != '-' || !arg[1] || arg[2])
+    {
+        return 0;
+    }
+
+    switch (arg[1])
+    {
+    case 'e':
+        return EXTRACT_MODE;
     case 'd':
-        program_mode = DECOMPRESS_MODE;
-        strcat(output_file_name, "_decomp.WAD");
-        printf("Decompression mode enabled!\n");
-        break;
+        return DECOMPRESS_MODE;
     case 'c':
-        program_mode = COMPRESS_MODE;
-        strcat(output_file_name, "_comp.WAD");
-        printf("Compression mode enabled!\n");
-        break;
+        return COMPRESS_MODE;
     case 'p':
-        program_mode = PAD_MODE;
-        strcat(output_file_name, "_pad.WAD");
-        printf("Padding mode enabled!\n");
-        break;
+        return PAD_MODE;
     default:
-        wadutil64_help();
-        return EXIT_FAILURE;
+        return 0;
+    }
+}
+
+// The image a mode leaves behind becomes the input of the next one
+void next_mode_input(arena_t* image, arena_t* input_image, mappedfile_t* input)
+{
+    arena_free(input_image);
+    *input_image = *image;
+    input->data = input_image->base;
+    input->size = input_image->used;
+
+    image->base = NULL;
+    image->size = 0;
+    image->used = 0;
+}
+
+// The input file name without its extension, in the output directory if there is one
+void output_base_name(const char* input_file_name, const options_t* options, char* output_file_name, size_t name_size)
+{
+    const char* base_name = input_file_name;
+    if (options->output_dir)
+    {
+        for (const char* c = input_file_name; *c; ++c)
+        {
+            if (*c == '/' || *c == '\\')
+            {
+                base_name = c + 1;
+            }
+        }
     }
 
-    // Create output file
-    FILE* output_file = fopen(output_file_name, "wb");
-    if (!output_file)
+    if (options->output_dir)
     {
-        printf("ERROR: Could not write decompressed WAD!\n");
-        return EXIT_FAILURE;
+        snprintf(output_file_name, name_size, "%s/%s", options->output_dir, base_name);
+    }
+    else
+    {
+        snprintf(output_file_name, name_size, "%s", base_name);
+    }
+
+    char* extension = strrchr(output_file_name, '.');
+    if (extension && !strpbrk(extension, "/\\"))
+    {
+        *extension = 0;
+    }
+}
+
+// Writes the lumps -x asked for, decoding only those, as <output_base>_<LUMP>.lmp.
+// Returns false if one is missing, corrupt or couldn't be written.
+bool extract_lumps(const mappedfile_t* input_WAD, const char* output_base, const options_t* options)
+{
+    wadreader_t reader;
+    if (!wadreader_open(&reader, input_WAD))
+    {
+        printf("ERROR: The lump directory of %s lies outside of the file!\n", input_WAD->name);
+        return false;
+    }
+
+    if (options->sidecar_file && !wadreader_use_sidecar(&reader, options->sidecar_file))
+    {
+        printf("%s isn't a sidecar of %s, decoding the lumps instead\n", options->sidecar_file, input_WAD->name);
+    }
+
+    std::vector<lumpstats_t> lump_stats(options->stats ? options->lump_names->size() : 0);
+    std::vector<byte> data;
+    bool extracted = true;
+
+    for (size_t i = 0; i < options->lump_names->size(); ++i)
+    {
+        const char* name = (*options->lump_names)[i].c_str();
+        lumpstats_t* stats = options->stats ? &(lump_stats[i]) : NULL;
+
+        int lump = wadreader_find(&reader, name);
+        if (lump < 0)
+        {
+            printf("ERROR: %s has no lump %s!\n", input_WAD->name, name);
+            extracted = false;
+            continue;
+        }
+
+        double start = stats_clock(stats);
+        int source_size;
+        if (!wadreader_read(&reader, lump, &data, &source_size))
+        {
+            printf("ERROR: Lump %s of %s is corrupt!\n", name, input_WAD->name);
+            extracted = false;
+            continue;
+        }
+
+        // Lumps read as they are count as reading, decoded ones as decoding, reading their source included
+        if (stats)
+        {
+            init_lump_stats(stats, input_WAD, "lump", &(reader.lump_directory[lump]), wadreader_decode_mode(&reader, lump), source_size == 0);
+            stats->name[0] &= 0x7F;
+            stats->input_size = source_size ? source_size : (int) data.size();
+            stats->output_size = data.size();
+            if (source_size)
+            {
+                stats->code_seconds = stats_clock(stats) - start;
+            }
+            else
+            {
+                stats->read_seconds = stats_clock(stats) - start;
+            }
+        }
+
+        std::string lump_name = lump_name_string(reader.lump_directory[lump].name);
+        char lump_file_name[560];
+        snprintf(lump_file_name, sizeof(lump_file_name), "%s_%s.lmp", output_base, lump_name.c_str());
+
+        double write_start = stats_clock(stats);
+
+        outputfile_t lump_file;
+        bool written = output_open(&lump_file, lump_file_name);
+        if (written)
+        {
+            fwrite(data.data(), data.size(), 1, lump_file.file);
+            written = output_commit(&lump_file);
+        }
+
+        if (!written)
+        {
+            printf("ERROR: Could not write %s!\n", lump_file_name);
+            extracted = false;
+            continue;
+        }
+
+        if (stats)
+        {
+            stats->write_seconds = stats_clock(stats) - write_start;
+        }
+
+        printf("Wrote lump %s to %s\n", lump_name.c_str(), lump_file_name);
+    }
+
+    if (options->stats)
+    {
+        stats_add_lumps(options->stats, &lump_stats);
+    }
+
+    wadreader_close(&reader);
+
+    return extracted;
+}
+
+typedef struct
+{
+    int             lump;
+    byte            decode_mode;
+    int             rom_size;       // as stored in the WAD
+    decodecounts_t  counts;
+    double          load_ms;        // reading it off the cartridge and decoding it
+    double          raw_ms;         // reading it off the cartridge if it were stored as it is
+} lumpprofile_t;
+
+// Prints every lump of the WAD by estimated N64 load time, slowest first.
+// Returns false if one of them is corrupt.
+bool profile_lumps(const mappedfile_t* input_WAD)
+{
+    wadreader_t reader;
+    if (!wadreader_open(&reader, input_WAD))
+    {
+        printf("ERROR: The lump directory of %s lies outside of the file!\n", input_WAD->name);
+        return false;
     }
 
-    switch (program_mode)
+    std::vector<lumpprofile_t> profiles;
+    bool profiled = true;
+
+    for (int i = 0; i < reader.header.numlumps; ++i)
+    {
+        const lumpinfo_t* lump_info = &(reader.lump_directory[i]);
+        if (lump_info->size <= 0)
+        {
+            continue;
+        }
+
+        lumpprofile_t profile;
+        profile.lump = i;
+        profile.decode_mode = wadreader_decode_mode(&reader, i);
+        const byte* lump_data = wadreader_source(&reader, i, &profile.rom_size);
+
+        if (!(lump_info->name[0] & 0x80))
+        {
+            profile.decode_mode = DECODE_NONE;
+        }
+
+        if (!lump_data || !profile_lump_data(lump_data, profile.rom_size, lump_info->size, profile.decode_mode, &profile.counts))
+        {
+            printf("ERROR: Lump %s of %s is corrupt!\n", lump_name_string(lump_info->name).c_str(), input_WAD->name);
+            profiled = false;
+            continue;
+        }
+
+        profile.load_ms = load_ms(&profile.counts, profile.rom_size);
+        profile.raw_ms = rom_read_ms(lump_info->size);
+        profiles.push_back(profile);
+    }
+
+    std::stable_sort(profiles.begin(), profiles.end(), [](const lumpprofile_t& a, const lumpprofile_t& b)
+    {
+        return a.load_ms > b.load_ms;
+    });
+
+    static const char* codec_names[] = { "stored", "jaguar", "d64" };
+
+    printf("\nEstimated N64 load times of %s\n", input_WAD->name);
+    printf("%-8s %-6s %9s %9s %10s %10s %10s %9s %9s\n", "lump", "codec", "rom", "size",
+        "bits", "tree", "copied", "load ms", "raw ms");
+
+    double total_load_ms = 0;
+    double total_raw_ms = 0;
+    for (const lumpprofile_t& profile : profiles)
+    {
+        const decodecounts_t* counts = &profile.counts;
+        printf("%-8s %-6s %9d %9d %10lld %10lld %10lld %9.3f %9.3f\n",
+            lump_name_string(reader.lump_directory[profile.lump].name).c_str(), codec_names[profile.decode_mode],
+            profile.rom_size, reader.lump_directory[profile.lump].size,
+            counts->code_bits, counts->tree_steps, counts->match_bytes, profile.load_ms, profile.raw_ms);
+
+        total_load_ms += profile.load_ms;
+        total_raw_ms += profile.raw_ms;
+    }
+
+    printf("Total: %d lumps, load %.3f ms, %.3f ms if all were stored as they are\n",
+        static_cast<int>(profiles.size()), total_load_ms, total_raw_ms);
+
+    wadreader_close(&reader);
+
+    return profiled;
+}
+
+// Runs the modes on one input file, returns false if it couldn't be opened or written
+bool process_file(const char* input_file_name, int program_modes, const options_t* options)
+{
+    double start = stats_clock(options->stats);
+
+    // Open input file
+    mappedfile_t input_file;
+    if (!map_file(input_file_name, &input_file))
+    {
+        printf("ERROR: Input file %s not found!\n", input_file_name);
+        return false;
+    }
+
+    // Output file name is the input's without extension, with a suffix for every mode that runs,
+    // put in the output directory if there is one
+    char output_file_name[512];
+    output_base_name(input_file_name, options, output_file_name, sizeof(output_file_name));
+
+    if (program_modes & LUMP_MODE)
+    {
+        bool extracted = extract_lumps(&input_file, output_file_name, options);
+
+        if (options->stats)
+        {
+            filestats_t file_stats;
+            file_stats.file_name = input_file_name;
+            file_stats.write_seconds = 0;
+            file_stats.seconds = stats_clock(options->stats) - start;
+            stats_add_file(options->stats, &file_stats);
+        }
+
+        unmap_file(&input_file);
+        return extracted;
+    }
+
+    if (program_modes & PROFILE_MODE)
+    {
+        bool profiled = profile_lumps(&input_file);
+        unmap_file(&input_file);
+        return profiled;
+    }
+
+    size_t name_size = sizeof(output_file_name);
+    if (program_modes & EXTRACT_MODE)
+    {
+        strncat(output_file_name, "_extract", name_size - strlen(output_file_name) - 1);
+        printf("Extraction mode enabled!\n");
+    }
+    if (program_modes & DECOMPRESS_MODE)
+    {
+        strncat(output_file_name, "_decomp", name_size - strlen(output_file_name) - 1);
+        printf("Decompression mode enabled!\n");
+    }
+    if (program_modes & PAD_MODE)
     {
-    case EXTRACT_MODE:
-        extract_WAD(input_file, output_file);
+        strncat(output_file_name, "_pad", name_size - strlen(output_file_name) - 1);
+        printf("Padding mode enabled!\n");
+    }
+    if (program_modes & COMPRESS_MODE)
+    {
+        strncat(output_file_name, "_comp", name_size - strlen(output_file_name) - 1);
+        printf("Compression mode enabled!\n");
+    }
+    strncat(output_file_name, ".WAD", name_size - strlen(output_file_name) - 1);
+
+    // Create output file, it only replaces one of the same name once it is complete
+    outputfile_t output;
+    if (!output_open(&output, output_file_name))
+    {
+        printf("ERROR: Could not write %s!\n", output_file_name);
+        unmap_file(&input_file);
+        return false;
+    }
+
+    // Every mode builds the whole WAD in memory, only the last one gets written out
+    mappedfile_t input = input_file;
+    arena_t input_image = { NULL, 0, 0 };
+    arena_t image = { NULL, 0, 0 };
+
+    // Decompressed lumps are laid out padded right away, there's no separate padding pass after them.
+    // Streaming writes the lumps out as they decode, so only works if nothing comes after it.
+    bool pad_layout = (program_modes & PAD_MODE) != 0;
+    FILE* stream_file = (program_modes & COMPRESS_MODE) ? NULL : output.file;
+
+    // The decoders pass their output on in small chunks, a large buffer combines them into few writes
+    if (stream_file && options->stream)
+    {
+        setvbuf(stream_file, NULL, _IOFBF, 1 << 20);
+    }
+
+    if (program_modes & EXTRACT_MODE)
+    {
+        extract_WAD(&input, &image, stream_file, pad_layout, options);
+        next_mode_input(&image, &input_image, &input);
         printf("Extraction complete!\n");
-        break;
-    case DECOMPRESS_MODE:
-        decompress_WAD(input_file, output_file);
+    }
+    else if (program_modes & DECOMPRESS_MODE)
+    {
+        decompress_WAD(&input, &image, stream_file, pad_layout, options);
+        next_mode_input(&image, &input_image, &input);
         printf("Decompression complete!\n");
-        break;
-    case COMPRESS_MODE:
-#if 0
-        compress_WAD(input_file, output_file);
-        printf("Compression complete!\n");
-#endif
-        printf("TODO: Compression not implemented yet.");
-        break;
-    case PAD_MODE:
-        pad_WAD(input_file, output_file);
+    }
+    else if (program_modes & PAD_MODE)
+    {
+        pad_WAD(&input, &image);
+        next_mode_input(&image, &input_image, &input);
         printf("Padding complete!\n");
-        break;
-    
-    default:
-        break;
-    }
-    
-    fclose(input_file);
-    fclose(output_file);
-    
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    }
+
+    if (program_modes & COMPRESS_MODE)
+    {
+        compress_WAD(&input, &image, options);
+        next_mode_input(&image, &input_image, &input);
+        printf("Compression complete!\n");
+    }
+
+    double write_start = stats_clock(options->stats);
+
+    // Nothing to write if the lumps were streamed out already
+    if (input_image.base)
+    {
+        fwrite(input_image.base, input_image.used, 1, output.file);
+    }
+
+    bool written = output_commit(&output);
+    if (!written)
+    {
+        printf("ERROR: Could not write %s!\n", output_file_name);
+    }
+
+    if (options->stats)
+    {
+        filestats_t file_stats;
+        file_stats.file_name = input_file_name;
+        file_stats.write_seconds = stats_clock(options->stats) - write_start;
+        file_stats.seconds = stats_clock(options->stats) - start;
+        stats_add_file(options->stats, &file_stats);
+    }
+
+    arena_free(&input_image);
+    unmap_file(&input_file);
+
+    return written;
+}
+
+// Adds the file names listed in manifest_name, one per line
+bool read_manifest(const char* manifest_name, std::vector<std::string>* input_file_names)
+{
+    FILE* manifest = fopen(manifest_name, "r");
+    if (!manifest)
+    {
+        return false;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), manifest))
+    {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0])
+        {
+            input_file_names->push_back(line);
+        }
+    }
+
+    fclose(manifest);
+
+    return true;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    std::ios::sync_with_stdio(false);
+
+    if (argc < 3)
+    {
+        wadutil64_help();
+        return EXIT_FAILURE;
+    }
+
+    int program_modes = parse_mode(argv[1]);
+    if (!program_modes && strcmp(argv[1], "-x") && strcmp(argv[1], "--profile-load"))
+    {
+        wadutil64_help();
+        return EXIT_FAILURE;
+    }
+
+    // Parse further modes and options after the first mode, everything else is an input file
+    options_t options;
+    options.num_threads = 1;
+    options.level = ENCODE_FAST;
+    options.cache_dir = NULL;
+    options.stream = false;
+    options.output_dir = NULL;
+    options.stats = NULL;
+    options.verify = false;
+
+    std::vector<std::string> lump_names;
+    options.lump_names = &lump_names;
+    options.sidecar_file = NULL;
+    options.min_saving = 0;
+    options.always_compress = false;
+    options.ms_per_kb = -1;
+
+    std::vector<std::string> input_file_names;
+    statsreport_t stats;
+    bool print_stats = false;
+    const char* stats_json_file_name = NULL;
+
+    // Set by any option that isn't known or has a value out of range, which shows the help
+    bool bad_option = false;
+
+    for (int i = program_modes ? 2 : 1; i < argc; ++i)
+    {
+        if (argv[i][0] != '-')
+        {
+            input_file_names.push_back(argv[i]);
+        }
+        else if (!strcmp(argv[i], "-x") && i + 1 < argc)
+        {
+            program_modes |= LUMP_MODE;
+            lump_names.push_back(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--profile-load"))
+        {
+            program_modes |= PROFILE_MODE;
+        }
+        else if (parse_mode(argv[i]))
+        {
+            program_modes |= parse_mode(argv[i]);
+        }
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+        {
+            options.num_threads = atoi(argv[++i]);
+            bad_option = options.num_threads <= 0;
+        }
+        else if (!strcmp(argv[i], "--level=fast"))
+        {
+            options.level = ENCODE_FAST;
+        }
+        else if (!strcmp(argv[i], "--level=max"))
+        {
+            options.level = ENCODE_MAX;
+        }
+        else if (!strncmp(argv[i], "--cache=", 8) && argv[i][8])
+        {
+            options.cache_dir = argv[i] + 8;
+        }
+        else if (!strcmp(argv[i], "--stream"))
+        {
+            options.stream = true;
+        }
+        else if (!strncmp(argv[i], "--out=", 6) && argv[i][6])
+        {
+            options.output_dir = argv[i] + 6;
+        }
+        else if (!strcmp(argv[i], "--verify"))
+        {
+            options.verify = true;
+        }
+        else if (!strcmp(argv[i], "--stats"))
+        {
+            print_stats = true;
+            options.stats = &stats;
+        }
+        else if (!strncmp(argv[i], "--stats-json=", 13) && argv[i][13])
+        {
+            stats_json_file_name = argv[i] + 13;
+            options.stats = &stats;
+        }
+        else if (!strncmp(argv[i], "--min-saving=", 13) && argv[i][13])
+        {
+            options.min_saving = atoi(argv[i] + 13);
+            bad_option = options.min_saving < 0 || options.min_saving > 100;
+        }
+        else if (!strcmp(argv[i], "--always-compress"))
+        {
+            options.always_compress = true;
+        }
+        else if (!strncmp(argv[i], "--ms-per-kb=", 12) && argv[i][12])
+        {
+            options.ms_per_kb = atof(argv[i] + 12);
+            bad_option = options.ms_per_kb < 0;
+        }
+        else if (!strncmp(argv[i], "--sidecar=", 10) && argv[i][10])
+        {
+            options.sidecar_file = argv[i] + 10;
+        }
+        else if (!strncmp(argv[i], "--list=", 7) && argv[i][7])
+        {
+            if (!read_manifest(argv[i] + 7, &input_file_names))
+            {
+                printf("ERROR: Could not read the file list %s!\n", argv[i] + 7);
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            bad_option = true;
+        }
+
+        if (bad_option)
+        {
+            wadutil64_help();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Extraction already decompresses, single lumps and profiles come out on their own
+    if (input_file_names.empty() || ((program_modes & EXTRACT_MODE) && (program_modes & DECOMPRESS_MODE)) ||
+        ((program_modes & LUMP_MODE) && program_modes != LUMP_MODE) ||
+        ((program_modes & PROFILE_MODE) && program_modes != PROFILE_MODE))
+    {
+        wadutil64_help();
+        return EXIT_FAILURE;
+    }
+
+    // A sidecar belongs to one WAD, and -d needs the whole image to write it
+    if (options.sidecar_file && (input_file_names.size() > 1 || options.stream ||
+        !(program_modes & (DECOMPRESS_MODE | LUMP_MODE))))
+    {
+        wadutil64_help();
+        return EXIT_FAILURE;
+    }
+
+    if (options.cache_dir && !cache_open(options.cache_dir))
+    {
+        printf("ERROR: Could not use %s as the lump cache!\n", options.cache_dir);
+        return EXIT_FAILURE;
+    }
+
+    if (options.output_dir && !make_directory(options.output_dir))
+    {
+        printf("ERROR: Could not use %s as the output directory!\n", options.output_dir);
+        return EXIT_FAILURE;
+    }
+
+    // Files are jobs on the same threads as their lumps, so a batch of small
+    // WADs keeps every thread busy as well as one large WAD does
+    int file_count = static_cast<int>(input_file_names.size());
+    std::vector<double> file_seconds(file_count);
+    std::atomic<int> failed_files(0);
+    std::chrono::steady_clock::time_point batch_start = std::chrono::steady_clock::now();
+
+    start_jobs(options.num_threads);
+
+    run_jobs(file_count, [&](int i)
+    {
+        std::chrono::steady_clock::time_point file_start = std::chrono::steady_clock::now();
+
+        if (!process_file(input_file_names[i].c_str(), program_modes, &options))
+        {
+            failed_files++;
+        }
+
+        file_seconds[i] = seconds_since(file_start);
+    });
+
+    stop_jobs();
+
+    if (print_stats)
+    {
+        stats_print(&stats);
+    }
+
+    if (stats_json_file_name && !stats_write_json(&stats, stats_json_file_name))
+    {
+        printf("ERROR: Could not write the stats to %s!\n", stats_json_file_name);
+        failed_files++;
+    }
+
+    if (file_count > 1)
+    {
+        double total_seconds = 0;
+        for (int i = 0; i < file_count; ++i)
+        {
+            printf("%s: %.3f s\n", input_file_names[i].c_str(), file_seconds[i]);
+            total_seconds += file_seconds[i];
+        }
+
+        printf("Processed %d files in %.3f s (%.3f s summed over files), %d failed\n",
+            file_count, seconds_since(batch_start), total_seconds, failed_files.load());
+    }
+
+    return failed_files ? EXIT_FAILURE : EXIT_SUCCESS;
+}
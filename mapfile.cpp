@@ -0,0 +1,268 @@
+#include <cerrno>
+#include "wadutil64_def.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool map_file(const char* file_name, mappedfile_t* file)
+{
+    file->data = NULL;
+    file->size = 0;
+    file->name = file_name;
+
+#ifdef _WIN32
+    HANDLE file_handle = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size))
+    {
+        CloseHandle(file_handle);
+        return false;
+    }
+
+    // Empty files can't be mapped, they are left as an empty view
+    if (file_size.QuadPart > 0)
+    {
+        HANDLE mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping_handle)
+        {
+            CloseHandle(file_handle);
+            return false;
+        }
+
+        file->data = (const byte*) MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping_handle);
+        if (!file->data)
+        {
+            CloseHandle(file_handle);
+            return false;
+        }
+    }
+
+    // The view keeps the file open on its own
+    CloseHandle(file_handle);
+    file->size = (size_t) file_size.QuadPart;
+#else
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    // Empty files can't be mapped, they are left as an empty view
+    if (file_stat.st_size > 0)
+    {
+        void* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+
+        file->data = (const byte*) data;
+    }
+
+    // The mapping keeps the file open on its own
+    close(fd);
+    file->size = (size_t) file_stat.st_size;
+#endif
+
+    return true;
+}
+
+void unmap_file(mappedfile_t* file)
+{
+    if (file->data)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(file->data);
+#else
+        munmap((void*) file->data, file->size);
+#endif
+    }
+
+    file->data = NULL;
+    file->size = 0;
+}
+
+// Creating fails if the directory is already there, so it is checked by writing to it.
+// The probe is a temporary file of its own, so probing never touches a file that was there
+// or one another thread or process is probing with.
+bool make_directory(const char* dir_name)
+{
+#ifdef _WIN32
+    _mkdir(dir_name);
+#else
+    mkdir(dir_name, 0777);
+#endif
+
+    char base_name[512];
+    char probe_name[560];
+    snprintf(base_name, sizeof(base_name), "%s/.probe", dir_name);
+
+    FILE* probe = create_temp_file(base_name, probe_name, sizeof(probe_name));
+    if (!probe)
+    {
+        return false;
+    }
+
+    fclose(probe);
+    remove(probe_name);
+
+    return true;
+}
+
+// Creates a file of its own next to file_name and opens it for writing. The name has the process id
+// and a count in it, and the file is only created if there's none of that name yet, so no two
+// threads or processes writing the same file ever share a temporary one.
+FILE* create_temp_file(const char* file_name, char* temp_name, size_t temp_name_size)
+{
+    static std::atomic<unsigned int> temp_count(0);
+
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = (unsigned long) getpid();
+#endif
+
+    // A name can only be taken by a file left behind by an earlier process of the same id
+    for (int attempt = 0; attempt < 100; ++attempt)
+    {
+        snprintf(temp_name, temp_name_size, "%s.%lu-%u.tmp", file_name, pid, temp_count++);
+
+#ifdef _WIN32
+        int fd = _open(temp_name, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        int fd = open(temp_name, O_WRONLY | O_CREAT | O_EXCL, 0666);
+#endif
+        if (fd >= 0)
+        {
+#ifdef _WIN32
+            FILE* file = _fdopen(fd, "wb");
+            if (!file)
+            {
+                _close(fd);
+            }
+#else
+            FILE* file = fdopen(fd, "wb");
+            if (!file)
+            {
+                close(fd);
+            }
+#endif
+            return file;
+        }
+
+        if (errno != EEXIST)
+        {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+// Temporary files still open, removed if the program exits before they are committed.
+// Allocated and never destroyed, an exit() on another thread may still use them.
+static std::mutex& pending_outputs_lock = *new std::mutex;
+static std::vector<std::string>& pending_outputs = *new std::vector<std::string>;
+
+static void remove_pending_outputs()
+{
+    std::lock_guard<std::mutex> lock(pending_outputs_lock);
+    for (const std::string& temp_name : pending_outputs)
+    {
+        remove(temp_name.c_str());
+    }
+    pending_outputs.clear();
+}
+
+static void forget_pending_output(const char* temp_name)
+{
+    std::lock_guard<std::mutex> lock(pending_outputs_lock);
+    for (size_t i = 0; i < pending_outputs.size(); ++i)
+    {
+        if (pending_outputs[i] == temp_name)
+        {
+            pending_outputs.erase(pending_outputs.begin() + i);
+            break;
+        }
+    }
+}
+
+bool output_open(outputfile_t* output, const char* file_name)
+{
+    static std::once_flag cleanup_registered;
+    std::call_once(cleanup_registered, []() { atexit(remove_pending_outputs); });
+
+    snprintf(output->file_name, sizeof(output->file_name), "%s", file_name);
+
+    // Registered under the lock it was created in, so an exit() in between can't miss it
+    std::lock_guard<std::mutex> lock(pending_outputs_lock);
+
+    output->file = create_temp_file(file_name, output->temp_name, sizeof(output->temp_name));
+    if (!output->file)
+    {
+        return false;
+    }
+
+    pending_outputs.push_back(output->temp_name);
+
+    return true;
+}
+
+bool output_commit(outputfile_t* output)
+{
+    bool written = !ferror(output->file);
+    written = (fclose(output->file) == 0) && written;
+    output->file = NULL;
+
+#ifdef _WIN32
+    written = written && MoveFileExA(output->temp_name, output->file_name, MOVEFILE_REPLACE_EXISTING);
+#else
+    written = written && rename(output->temp_name, output->file_name) == 0;
+#endif
+
+    if (!written)
+    {
+        remove(output->temp_name);
+    }
+
+    forget_pending_output(output->temp_name);
+
+    return written;
+}
+
+void output_discard(outputfile_t* output)
+{
+    if (output->file)
+    {
+        fclose(output->file);
+        output->file = NULL;
+    }
+
+    remove(output->temp_name);
+    forget_pending_output(output->temp_name);
+}
@@ -0,0 +1,83 @@
+#include "wadutil64_def.h"
+
+// Header, then the entries, then the decompressed lumps 4 byte aligned.
+// Fills in the header's identification, version and entry count and every entry's filepos.
+bool sidecar_write(const char* file_name, sidecarinfo_t* header, std::vector<sidecarlump_t>* lumps, const std::vector<const byte*>* lump_data)
+{
+    memcpy(header->identification, "LMPC", 4);
+    header->version = SIDECAR_VERSION;
+    header->numentries = static_cast<int>(lumps->size());
+
+    long long filepos = sizeof(sidecarinfo_t) + lumps->size() * sizeof(sidecarlump_t);
+    for (sidecarlump_t& lump : *lumps)
+    {
+        if (filepos > INT_MAX - lump.size - 3)
+        {
+            return false;
+        }
+
+        lump.filepos = static_cast<int>(filepos);
+        filepos += (lump.size + 3) & ~3;
+    }
+
+    // Readers never see a partial one
+    outputfile_t output;
+    if (!output_open(&output, file_name))
+    {
+        return false;
+    }
+
+    FILE* sidecar = output.file;
+
+    static const byte padding[4] = { 0, 0, 0, 0 };
+
+    bool written = fwrite(header, sizeof(sidecarinfo_t), 1, sidecar) == 1;
+    written = written && (lumps->empty() || fwrite(lumps->data(), lumps->size() * sizeof(sidecarlump_t), 1, sidecar) == 1);
+    for (size_t i = 0; written && i < lumps->size(); ++i)
+    {
+        int size = (*lumps)[i].size;
+        int padding_size = ((size + 3) & ~3) - size;
+        written = (size == 0 || fwrite((*lump_data)[i], size, 1, sidecar) == 1) &&
+            (padding_size == 0 || fwrite(padding, padding_size, 1, sidecar) == 1);
+    }
+
+    if (!written)
+    {
+        output_discard(&output);
+        return false;
+    }
+
+    return output_commit(&output);
+}
+
+// Maps the sidecar and checks that every entry lies within it,
+// returns false if it is missing or isn't one
+bool sidecar_open(const char* file_name, mappedfile_t* file, const sidecarinfo_t** header, const sidecarlump_t** lumps)
+{
+    if (!map_file(file_name, file))
+    {
+        return false;
+    }
+
+    *header = (const sidecarinfo_t*) file->data;
+    *lumps = (const sidecarlump_t*) (file->data + sizeof(sidecarinfo_t));
+
+    bool valid = file->size >= sizeof(sidecarinfo_t) && !memcmp((*header)->identification, "LMPC", 4) &&
+        (*header)->version == SIDECAR_VERSION && (*header)->numentries >= 0 &&
+        (size_t) (*header)->numentries <= (file->size - sizeof(sidecarinfo_t)) / sizeof(sidecarlump_t);
+
+    for (int i = 0; valid && i < (*header)->numentries; ++i)
+    {
+        const sidecarlump_t* lump = &((*lumps)[i]);
+        valid = lump->lump >= 0 && lump->lump < (*header)->numlumps && lump->filepos >= 0 && lump->size >= 0 &&
+            (size_t) lump->filepos + lump->size <= file->size;
+    }
+
+    if (!valid)
+    {
+        unmap_file(file);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include "wadutil64_def.h"
+
+// Indexed by decodetype
+static const char* codec_names[] = { "none", "jaguar", "d64" };
+
+double stats_clock(const void* stats)
+{
+    if (!stats)
+    {
+        return 0;
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void stats_add_lumps(statsreport_t* report, const std::vector<lumpstats_t>* lumps)
+{
+    std::lock_guard<std::mutex> lock(report->lock);
+
+    // Markers have nothing to report
+    for (const lumpstats_t& lump : *lumps)
+    {
+        if (lump.input_size || lump.output_size)
+        {
+            report->lumps.push_back(lump);
+        }
+    }
+}
+
+void stats_add_file(statsreport_t* report, const filestats_t* file)
+{
+    std::lock_guard<std::mutex> lock(report->lock);
+    report->files.push_back(*file);
+}
+
+static double ratio(long long output_size, long long input_size)
+{
+    return (input_size > 0) ? (double) output_size / input_size : 0;
+}
+
+typedef struct
+{
+    int         lumps;
+    long long   input_size;
+    long long   output_size;
+    double      read_seconds;
+    double      code_seconds;
+    double      verify_seconds;
+    double      write_seconds;
+    double      code_percentiles[4];    // p50, p90, p99 and the slowest
+} statstotals_t;
+
+static const int percentiles[4] = { 50, 90, 99, 100 };
+
+static void stats_totals(const statsreport_t* report, statstotals_t* totals)
+{
+    memset(totals, 0, sizeof(statstotals_t));
+
+    std::vector<double> code_seconds;
+    for (const lumpstats_t& lump : report->lumps)
+    {
+        totals->lumps++;
+        totals->input_size += lump.input_size;
+        totals->output_size += lump.output_size;
+        totals->read_seconds += lump.read_seconds;
+        totals->code_seconds += lump.code_seconds;
+        totals->verify_seconds += lump.verify_seconds;
+        totals->write_seconds += lump.write_seconds;
+        code_seconds.push_back(lump.code_seconds);
+    }
+
+    if (code_seconds.empty())
+    {
+        return;
+    }
+
+    // Nearest rank
+    std::sort(code_seconds.begin(), code_seconds.end());
+    for (int i = 0; i < 4; ++i)
+    {
+        size_t rank = (code_seconds.size() * percentiles[i] + 99) / 100;
+        totals->code_percentiles[i] = code_seconds[std::max(rank, (size_t) 1) - 1];
+    }
+}
+
+void stats_print(const statsreport_t* report)
+{
+    printf("\n%-24s %-10s %-8s %-6s %9s %9s %6s %9s %9s %9s %9s\n", "file", "mode", "lump", "codec",
+        "in", "out", "ratio", "read ms", "code ms", "verify ms", "write ms");
+
+    for (const lumpstats_t& lump : report->lumps)
+    {
+        printf("%-24s %-10s %-8s %-6s %9d %9d %6.3f %9.3f %9.3f %9.3f %9.3f\n", lump.file_name, lump.mode, lump.name,
+            lump.stored ? "stored" : codec_names[lump.codec], lump.input_size, lump.output_size,
+            ratio(lump.output_size, lump.input_size),
+            lump.read_seconds * 1000, lump.code_seconds * 1000, lump.verify_seconds * 1000, lump.write_seconds * 1000);
+    }
+
+    statstotals_t totals;
+    stats_totals(report, &totals);
+
+    printf("Total: %d lumps, %lld -> %lld bytes (%.3f), read %.3f ms, code %.3f ms, verify %.3f ms, write %.3f ms\n",
+        totals.lumps, totals.input_size, totals.output_size, ratio(totals.output_size, totals.input_size),
+        totals.read_seconds * 1000, totals.code_seconds * 1000, totals.verify_seconds * 1000, totals.write_seconds * 1000);
+    printf("Code time per lump: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+        totals.code_percentiles[0] * 1000, totals.code_percentiles[1] * 1000,
+        totals.code_percentiles[2] * 1000, totals.code_percentiles[3] * 1000);
+
+    for (const filestats_t& file : report->files)
+    {
+        printf("%s: %.3f ms, of that writing the output %.3f ms\n", file.file_name, file.seconds * 1000, file.write_seconds * 1000);
+    }
+}
+
+static void write_json_string(FILE* json, const char* string)
+{
+    fputc('"', json);
+    for (const char* c = string; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(json, "\\%c", *c);
+        }
+        else if ((unsigned char) *c < 0x20 || (unsigned char) *c >= 0x7F)
+        {
+            fprintf(json, "\\u%04x", (unsigned char) *c);
+        }
+        else
+        {
+            fputc(*c, json);
+        }
+    }
+    fputc('"', json);
+}
+
+bool stats_write_json(const statsreport_t* report, const char* json_file_name)
+{
+    FILE* json = fopen(json_file_name, "w");
+    if (!json)
+    {
+        return false;
+    }
+
+    fprintf(json, "{\n  \"lumps\": [");
+    for (size_t i = 0; i < report->lumps.size(); ++i)
+    {
+        const lumpstats_t& lump = report->lumps[i];
+
+        fprintf(json, "%s\n    { \"file\": ", i ? "," : "");
+        write_json_string(json, lump.file_name);
+        fprintf(json, ", \"mode\": \"%s\", \"name\": ", lump.mode);
+        write_json_string(json, lump.name);
+        fprintf(json, ", \"codec\": \"%s\", \"stored\": %s, \"input_size\": %d, \"output_size\": %d, \"ratio\": %.4f, "
+            "\"read_seconds\": %.9f, \"code_seconds\": %.9f, \"verify_seconds\": %.9f, \"write_seconds\": %.9f }",
+            codec_names[lump.codec], lump.stored ? "true" : "false", lump.input_size, lump.output_size,
+            ratio(lump.output_size, lump.input_size), lump.read_seconds, lump.code_seconds, lump.verify_seconds,
+            lump.write_seconds);
+    }
+
+    fprintf(json, "\n  ],\n  \"files\": [");
+    for (size_t i = 0; i < report->files.size(); ++i)
+    {
+        const filestats_t& file = report->files[i];
+
+        fprintf(json, "%s\n    { \"file\": ", i ? "," : "");
+        write_json_string(json, file.file_name);
+        fprintf(json, ", \"seconds\": %.9f, \"write_seconds\": %.9f }", file.seconds, file.write_seconds);
+    }
+
+    statstotals_t totals;
+    stats_totals(report, &totals);
+
+    fprintf(json, "\n  ],\n  \"totals\": { \"lumps\": %d, \"input_size\": %lld, \"output_size\": %lld, \"ratio\": %.4f, "
+        "\"read_seconds\": %.9f, \"code_seconds\": %.9f, \"verify_seconds\": %.9f, \"write_seconds\": %.9f },\n",
+        totals.lumps, totals.input_size, totals.output_size, ratio(totals.output_size, totals.input_size),
+        totals.read_seconds, totals.code_seconds, totals.verify_seconds, totals.write_seconds);
+    fprintf(json, "  \"code_seconds_percentiles\": { \"p50\": %.9f, \"p90\": %.9f, \"p99\": %.9f, \"max\": %.9f }\n}\n",
+        totals.code_percentiles[0], totals.code_percentiles[1], totals.code_percentiles[2], totals.code_percentiles[3]);
+
+    return fclose(json) == 0;
+}
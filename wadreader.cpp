@@ -0,0 +1,260 @@
+#include <algorithm>
+#include "wadreader.h"
+
+// Unlike the modes, which stop at the first lump outside the file, the reader
+// is a library call and turns such lumps down, leaving it to the caller to report
+
+static const byte* file_view(const mappedfile_t* WAD, int offset, int size)
+{
+    if (offset < 0 || size < 0 || (size_t) offset + size > WAD->size)
+    {
+        return NULL;
+    }
+
+    return WAD->data + offset;
+}
+
+void choose_decode_mode(byte* decode_mode, char* lump_name)
+{
+    char MAP01_name[6] = "MAP01";
+    
+    if (!strcmp(lump_name, "S_START"))
+    {
+        *decode_mode = DECODE_JAGUAR;
+    }
+    else if (!strcmp(lump_name, "T_START"))
+    {
+        *decode_mode = DECODE_D64;
+    }
+    else if (!strcmp(lump_name, "T_END"))
+    {
+        *decode_mode = DECODE_JAGUAR;
+    }
+    else if (!strcmp(lump_name, MAP01_name))
+    {
+        *decode_mode = DECODE_D64;
+    }
+
+    MAP01_name[0] += 0x80;
+    if (!strcmp(lump_name, MAP01_name))
+    {
+        *decode_mode = DECODE_D64;
+    }
+}
+
+std::string lump_name_string(const char* name)
+{
+    char lump_name[9];
+    strncpy(lump_name, name, 8);
+    lump_name[8] = 0;
+    lump_name[0] &= 0x7F;
+
+    return lump_name;
+}
+
+// The key of a name in lump_index, the game's lookups don't care about case either
+static std::string lump_index_name(std::string name)
+{
+    for (size_t i = 0; i < name.size(); ++i)
+    {
+        name[i] = toupper((unsigned char) name[i]);
+    }
+
+    return name;
+}
+
+bool wadreader_open(wadreader_t* reader, const mappedfile_t* input_WAD)
+{
+    reader->WAD = input_WAD;
+    reader->sidecar.data = NULL;
+    reader->sidecar.size = 0;
+    reader->sidecar_lumps = NULL;
+
+    const byte* header_data = file_view(input_WAD, 0, sizeof(wadinfo_t));
+    if (!header_data)
+    {
+        return false;
+    }
+
+    memcpy(&reader->header, header_data, sizeof(wadinfo_t));
+
+    if (reader->header.numlumps < 0 || reader->header.numlumps > INT_MAX / (int) sizeof(lumpinfo_t))
+    {
+        return false;
+    }
+
+    int directory_size = reader->header.numlumps * sizeof(lumpinfo_t);
+    const byte* directory_data = file_view(input_WAD, reader->header.infotableofs, directory_size);
+    if (!directory_data)
+    {
+        return false;
+    }
+
+    reader->lump_directory.resize(reader->header.numlumps);
+    memcpy(reader->lump_directory.data(), directory_data, directory_size);
+
+    reader->lump_index.reserve(reader->header.numlumps);
+    for (int i = 0; i < reader->header.numlumps; ++i)
+    {
+        reader->lump_index.emplace(lump_index_name(lump_name_string(reader->lump_directory[i].name)), i);
+    }
+
+    return true;
+}
+
+bool wadreader_use_sidecar(wadreader_t* reader, const char* sidecar_file)
+{
+    const sidecarinfo_t* header;
+    if (!sidecar_open(sidecar_file, &reader->sidecar, &header, &reader->sidecar_lumps))
+    {
+        return false;
+    }
+
+    // Any change to the directory moves or renames lumps, the whole sidecar is stale then.
+    // wadreader_open already checked the directory lies inside the file.
+    int directory_size = reader->header.numlumps * sizeof(lumpinfo_t);
+    if (header->numlumps != reader->header.numlumps ||
+        header->directory_hash != hash_data(reader->WAD->data + reader->header.infotableofs, directory_size))
+    {
+        unmap_file(&reader->sidecar);
+        reader->sidecar_lumps = NULL;
+        return false;
+    }
+
+    // An entry only counts while the compressed data it came from is still the same.
+    // That is checked once here, so reading a lump from the sidecar is just a lookup.
+    reader->sidecar_entries.assign(reader->header.numlumps, -1);
+    for (int i = 0; i < header->numentries; ++i)
+    {
+        const sidecarlump_t* lump = &(reader->sidecar_lumps[i]);
+        const lumpinfo_t* lump_info = &(reader->lump_directory[lump->lump]);
+        const byte* source = file_view(reader->WAD, lump->source_pos, lump->source_size);
+
+        if ((lump_info->name[0] & 0x80) && lump->source_pos == lump_info->filepos && lump->size == lump_info->size &&
+            source && lump->source_hash == hash_data(source, lump->source_size))
+        {
+            reader->sidecar_entries[lump->lump] = i;
+        }
+    }
+
+    return true;
+}
+
+void wadreader_close(wadreader_t* reader)
+{
+    unmap_file(&reader->sidecar);
+    reader->sidecar_lumps = NULL;
+    reader->sidecar_entries.clear();
+    reader->lump_directory.clear();
+    reader->lump_index.clear();
+    reader->decode_modes.clear();
+}
+
+int wadreader_find(const wadreader_t* reader, const char* name)
+{
+    if (strlen(name) > 8)
+    {
+        return -1;
+    }
+
+    std::unordered_map<std::string, int>::const_iterator lump = reader->lump_index.find(lump_index_name(name));
+    return (lump != reader->lump_index.end()) ? lump->second : -1;
+}
+
+const byte* wadreader_view(const wadreader_t* reader, int i, int* size)
+{
+    const lumpinfo_t* lump_info = &(reader->lump_directory[i]);
+
+    if (!(lump_info->name[0] & 0x80))
+    {
+        *size = lump_info->size;
+        return file_view(reader->WAD, lump_info->filepos, lump_info->size);
+    }
+
+    int entry = reader->sidecar_lumps ? reader->sidecar_entries[i] : -1;
+    if (entry >= 0)
+    {
+        const sidecarlump_t* lump = &(reader->sidecar_lumps[entry]);
+        *size = lump->size;
+        return reader->sidecar.data + lump->filepos;
+    }
+
+    return NULL;
+}
+
+byte wadreader_decode_mode(wadreader_t* reader, int i)
+{
+    // Which codec a lump uses depends on the markers before it, so they are
+    // replayed once for the whole directory by the first lump that asks
+    if (reader->decode_modes.empty())
+    {
+        byte decode_mode = DECODE_NONE;
+        reader->decode_modes.resize(reader->header.numlumps);
+        for (int j = 0; j < reader->header.numlumps; ++j)
+        {
+            char lump_name[9];
+            strncpy(lump_name, reader->lump_directory[j].name, 8);
+            lump_name[8] = 0;
+            choose_decode_mode(&decode_mode, lump_name);
+            reader->decode_modes[j] = decode_mode;
+        }
+    }
+
+    return reader->decode_modes[i];
+}
+
+const byte* wadreader_source(const wadreader_t* reader, int i, int* size)
+{
+    const lumpinfo_t* lump_info = &(reader->lump_directory[i]);
+
+    // Like in plan_decompression of the -d mode
+    if (lump_info->name[0] & 0x80)
+    {
+        int next_pos = (i + 1 < reader->header.numlumps) ? reader->lump_directory[i + 1].filepos : reader->header.infotableofs;
+        *size = next_pos - lump_info->filepos;
+    }
+    else
+    {
+        *size = lump_info->size;
+    }
+
+    return file_view(reader->WAD, lump_info->filepos, *size);
+}
+
+bool wadreader_read(wadreader_t* reader, int i, std::vector<byte>* data, int* source_size)
+{
+    const lumpinfo_t* lump_info = &(reader->lump_directory[i]);
+    *source_size = 0;
+
+    if (lump_info->size < 0)
+    {
+        return false;
+    }
+
+    data->resize(lump_info->size);
+
+    int view_size;
+    const byte* view = wadreader_view(reader, i, &view_size);
+    if (view)
+    {
+        memcpy(data->data(), view, view_size);
+        return true;
+    }
+
+    // Anything stored as it is that wadreader_view turned down lies outside the file
+    byte decode_mode = wadreader_decode_mode(reader, i);
+    const byte* lump_data = wadreader_source(reader, i, source_size);
+    if (!lump_data || !(lump_info->name[0] & 0x80))
+    {
+        return false;
+    }
+
+    // Outside the codec regions there is nothing to decode it with, -d leaves it zeroed too
+    if (decode_mode == DECODE_NONE)
+    {
+        std::fill(data->begin(), data->end(), 0);
+        return true;
+    }
+
+    return wadutil64_decode(decode_mode, lump_data, *source_size, data->data(), lump_info->size) == WADUTIL64_OK;
+}
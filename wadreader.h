@@ -0,0 +1,75 @@
+#ifndef WADREADER_H
+#define WADREADER_H
+
+#include "wadutil64_def.h"
+
+// Which codec the lumps use depends on the markers they are between
+typedef enum
+{
+    DECODE_NONE,
+    DECODE_JAGUAR   = WADUTIL64_CODEC_JAGUAR,
+    DECODE_D64      = WADUTIL64_CODEC_D64
+} decodetype;
+
+typedef struct
+{
+    int         filepos;
+    int         size;
+    char        name[8];
+} lumpinfo_t;
+
+typedef struct
+{
+    char        identification[4];      /* should be IWAD */
+    int         numlumps;
+    int         infotableofs;
+} wadinfo_t;
+
+// Updates decode_mode if lump_name is one of the markers that switch codecs
+void choose_decode_mode(byte* decode_mode, char* lump_name);
+
+// Lump names fill all 8 bytes or end at a 0, the compressed flag is dropped
+std::string lump_name_string(const char* name);
+
+// Random access to the lumps of one WAD, for when only a few of them are needed.
+// The directory is kept as stored, names and all, only what a lookup needs is worked out.
+// Nothing is shared between readers, each one can be used on a thread of its own.
+typedef struct
+{
+    const mappedfile_t*     WAD;
+    wadinfo_t               header;
+    std::vector<lumpinfo_t> lump_directory;
+    std::unordered_map<std::string, int> lump_index;    // upper case name without the compressed flag, first lump of that name
+    std::vector<byte>       decode_modes;               // codec region of every lump, empty until a lump is read
+    mappedfile_t            sidecar;                    // decompressed lumps from an earlier -d, empty if none
+    const sidecarlump_t*    sidecar_lumps;
+    std::vector<int>        sidecar_entries;            // entry of every lump in the sidecar, -1 if it has none or it is stale
+} wadreader_t;
+
+// Returns false if input_WAD isn't a WAD with its directory inside the file
+bool wadreader_open(wadreader_t* reader, const mappedfile_t* input_WAD);
+void wadreader_close(wadreader_t* reader);
+
+// Lets the reader take lumps from the sidecar instead of decoding them, as long as they are
+// unchanged. Returns false if it isn't a sidecar of this WAD, the reader then decodes everything.
+bool wadreader_use_sidecar(wadreader_t* reader, const char* sidecar_file);
+
+// Returns the index of the lump called name, case doesn't matter, or -1 if there's none
+int wadreader_find(const wadreader_t* reader, const char* name);
+
+// Returns the codec region lump i is in
+byte wadreader_decode_mode(wadreader_t* reader, int i);
+
+// Returns the data of lump i as stored in the WAD, NULL if it lies outside the file.
+// A compressed lump takes up everything up to the next lump.
+const byte* wadreader_source(const wadreader_t* reader, int i, int* size);
+
+// Returns lump i in place if it can be read without decoding, as stored in the WAD
+// or from the sidecar, NULL if it has to be decoded or lies outside the file
+const byte* wadreader_view(const wadreader_t* reader, int i, int* size);
+
+// Decompresses lump i into data, returns false if it is corrupt. source_size is set to
+// the compressed bytes that were decoded, 0 if the lump could be read as it is.
+bool wadreader_read(wadreader_t* reader, int i, std::vector<byte>* data, int* source_size);
+
+#endif
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include "wadutil64_def.h"
+
+// The library API over the codecs, which work on int sizes and throw
+// std::bad_alloc when out of memory; nothing gets past here but status codes
+
+static bool valid_size(size_t size)
+{
+    return size <= INT_MAX;
+}
+
+static bool valid_codec(int codec)
+{
+    return codec == WADUTIL64_CODEC_JAGUAR || codec == WADUTIL64_CODEC_D64;
+}
+
+wadutil64_status wadutil64_decode(int codec, const unsigned char* input, size_t input_size,
+    unsigned char* output, size_t output_size)
+{
+    if (!valid_codec(codec) || !valid_size(input_size) || !valid_size(output_size))
+    {
+        return WADUTIL64_BAD_ARGUMENT;
+    }
+
+    // The buffer decoders don't allocate
+    bool decoded;
+    if (codec == WADUTIL64_CODEC_D64)
+    {
+        decoded = DecodeD64(input, (int) input_size, output, (int) output_size);
+    }
+    else
+    {
+        decoded = DecodeJaguar(input, (int) input_size, output, (int) output_size);
+    }
+
+    return decoded ? WADUTIL64_OK : WADUTIL64_CORRUPT;
+}
+
+wadutil64_status wadutil64_decode_stream(int codec, const unsigned char* input, size_t input_size,
+    size_t output_size, wadutil64_sink_t sink, void* context)
+{
+    if (!valid_codec(codec) || !valid_size(input_size) || !valid_size(output_size))
+    {
+        return WADUTIL64_BAD_ARGUMENT;
+    }
+
+    try
+    {
+        bool decoded;
+        if (codec == WADUTIL64_CODEC_D64)
+        {
+            decoded = DecodeD64Stream(input, (int) input_size, (int) output_size, sink, context);
+        }
+        else
+        {
+            decoded = DecodeJaguarStream(input, (int) input_size, (int) output_size, sink, context);
+        }
+
+        return decoded ? WADUTIL64_OK : WADUTIL64_CORRUPT;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return WADUTIL64_NO_MEMORY;
+    }
+}
+
+wadutil64_status wadutil64_profile(int codec, const unsigned char* input, size_t input_size,
+    size_t output_size, wadutil64_counts_t* counts)
+{
+    if (!valid_codec(codec) || !valid_size(input_size) || !valid_size(output_size))
+    {
+        return WADUTIL64_BAD_ARGUMENT;
+    }
+
+    try
+    {
+        bool profiled;
+        if (codec == WADUTIL64_CODEC_D64)
+        {
+            profiled = ProfileD64(input, (int) input_size, (int) output_size, counts);
+        }
+        else
+        {
+            profiled = ProfileJaguar(input, (int) input_size, (int) output_size, counts);
+        }
+
+        return profiled ? WADUTIL64_OK : WADUTIL64_CORRUPT;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return WADUTIL64_NO_MEMORY;
+    }
+}
+
+wadutil64_status wadutil64_encode(int codec, int level, const unsigned char* input, size_t input_size,
+    unsigned char* output, size_t output_capacity, size_t* output_size)
+{
+    *output_size = 0;
+
+    // There is no compressed form of nothing, the decoders always need an end code and a size
+    if (!valid_codec(codec) || (level != WADUTIL64_LEVEL_FAST && level != WADUTIL64_LEVEL_MAX) ||
+        !valid_size(input_size) || input_size == 0 || output == NULL)
+    {
+        return WADUTIL64_BAD_ARGUMENT;
+    }
+
+    int capacity = static_cast<int>(std::min(output_capacity, (size_t) INT_MAX));
+
+    try
+    {
+        // Written straight into output, what doesn't fit is only counted
+        int encoded;
+        if (codec == WADUTIL64_CODEC_D64)
+        {
+            encoded = Deflate_Encode(input, (int) input_size, level, output, capacity);
+        }
+        else
+        {
+            encoded = EncodeJaguar(input, (int) input_size, level, output, capacity);
+        }
+
+        if (encoded < 0)
+        {
+            return WADUTIL64_TOO_LARGE;
+        }
+
+        *output_size = encoded;
+
+        return WADUTIL64_OK;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return WADUTIL64_NO_MEMORY;
+    }
+}
+
+const char* wadutil64_status_string(wadutil64_status status)
+{
+    switch (status)
+    {
+    case WADUTIL64_OK:
+        return "ok";
+    case WADUTIL64_CORRUPT:
+        return "corrupt data";
+    case WADUTIL64_TOO_LARGE:
+        return "output too large";
+    case WADUTIL64_NO_MEMORY:
+        return "out of memory";
+    case WADUTIL64_BAD_ARGUMENT:
+        return "bad argument";
+    default:
+        return "unknown status";
+    }
+}
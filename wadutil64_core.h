@@ -0,0 +1,81 @@
+#ifndef WADUTIL64_CORE_H
+#define WADUTIL64_CORE_H
+
+// The Doom 64 lump codecs as a library, for calling them in-process.
+// Every call works only on the buffers it is given and keeps no state
+// between calls, so any number of threads can use it at the same time.
+// Nothing is printed, everything the caller needs to know comes back as a status.
+
+#include <stddef.h>
+
+#if defined(_WIN32) && defined(WADUTIL64_SHARED)
+#ifdef WADUTIL64_BUILDING
+#define WADUTIL64_API __declspec(dllexport)
+#else
+#define WADUTIL64_API __declspec(dllimport)
+#endif
+#else
+#define WADUTIL64_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The same numbers as the codec regions of a WAD
+#define WADUTIL64_CODEC_JAGUAR  1   // LZSS of sprites and everything after T_END
+#define WADUTIL64_CODEC_D64     2   // adaptive Huffman of textures and maps
+
+#define WADUTIL64_LEVEL_FAST    0   // greedy parse, the original encoder's output
+#define WADUTIL64_LEVEL_MAX     1   // optimal parse, slower but smaller
+
+typedef enum
+{
+    WADUTIL64_OK,
+    WADUTIL64_CORRUPT,          // the data doesn't decode to exactly the size asked for, it ends early or runs past it
+    WADUTIL64_TOO_LARGE,        // the encoded lump doesn't fit the output buffer, store it as it is instead
+    WADUTIL64_NO_MEMORY,
+    WADUTIL64_BAD_ARGUMENT      // unknown codec or level, or a size over 2 GB
+} wadutil64_status;
+
+// Receives decoded data in chunks as the streaming decoders go, in order
+typedef void (*wadutil64_sink_t)(void* context, const unsigned char* data, int size);
+
+// The work decoding a lump takes, counted the way the game's decoders go about it
+typedef struct
+{
+    long long   code_bits;      // D64: bits read, the game reads and tests each one on its own
+    long long   tree_steps;     // D64: nodes visited keeping the adaptive tree up to date
+    long long   rebuilds;       // D64: times every count in the tree was halved
+    long long   flag_bytes;     // Jaguar: bytes of token flags
+    long long   literals;
+    long long   matches;
+    long long   match_bytes;    // bytes copied by matches
+} wadutil64_counts_t;
+
+// Decodes a compressed lump of output_size bytes straight into output
+WADUTIL64_API wadutil64_status wadutil64_decode(int codec, const unsigned char* input, size_t input_size,
+    unsigned char* output, size_t output_size);
+
+// Like wadutil64_decode, passing the output to sink in small chunks instead of keeping all of it.
+// sink may already have been given some of it when the data turns out to be corrupt.
+WADUTIL64_API wadutil64_status wadutil64_decode_stream(int codec, const unsigned char* input, size_t input_size,
+    size_t output_size, wadutil64_sink_t sink, void* context);
+
+// Counts the work decoding a lump takes without keeping its output
+WADUTIL64_API wadutil64_status wadutil64_profile(int codec, const unsigned char* input, size_t input_size,
+    size_t output_size, wadutil64_counts_t* counts);
+
+// Encodes input into output and sets output_size to the encoded size, a multiple of 4.
+// The encoders stop as soon as the result can't fit output_capacity, which returns WADUTIL64_TOO_LARGE,
+// output may then hold part of it. An empty input returns WADUTIL64_BAD_ARGUMENT.
+WADUTIL64_API wadutil64_status wadutil64_encode(int codec, int level, const unsigned char* input, size_t input_size,
+    unsigned char* output, size_t output_capacity, size_t* output_size);
+
+WADUTIL64_API const char* wadutil64_status_string(wadutil64_status status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,11 +1,162 @@
+#ifndef WADUTIL64_DEF_H
+#define WADUTIL64_DEF_H
+
+#include <cctype>
+#include <climits>
 #include <cstdlib>
 #include <iostream>
 #include <cstdio>
 #include <cstring>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <thread>
+#include "wadutil64_core.h"
 
 typedef unsigned char byte;
 
-void DecodeD64(unsigned char *input, unsigned char *output);
-void DecodeJaguar(unsigned char *input, unsigned char *output);
-std::vector<byte> Deflate_Encode(byte *input, int size);
\ No newline at end of file
+typedef struct
+{
+    const byte* data;
+    size_t      size;
+    const char* name;   // for messages
+} mappedfile_t;
+
+bool map_file(const char* file_name, mappedfile_t* file);
+void unmap_file(mappedfile_t* file);
+bool make_directory(const char* dir_name);
+FILE* create_temp_file(const char* file_name, char* temp_name, size_t temp_name_size);    // a new file only this call writes
+
+// A file written under a temporary name and renamed into place once it is complete,
+// so nothing ever sees it half written. Uncommitted ones are removed at exit.
+typedef struct
+{
+    FILE*       file;
+    char        file_name[512];
+    char        temp_name[560];
+} outputfile_t;
+
+bool output_open(outputfile_t* output, const char* file_name);
+bool output_commit(outputfile_t* output);   // returns false if it couldn't be written, it is then removed
+void output_discard(outputfile_t* output);
+
+bool DecodeD64(const unsigned char *input, int input_size, unsigned char *output, int output_size);
+bool DecodeJaguar(const unsigned char *input, int input_size, unsigned char *output, int output_size);
+
+// Those of the library API, see wadutil64_core.h
+typedef wadutil64_sink_t decodesink_t;
+typedef wadutil64_counts_t decodecounts_t;
+
+// Return false like the decoders do if the data is corrupt, the counts are then incomplete
+bool ProfileD64(const unsigned char *input, int input_size, int output_size, decodecounts_t *counts);
+bool ProfileJaguar(const unsigned char *input, int input_size, int output_size, decodecounts_t *counts);
+
+bool DecodeD64Stream(const unsigned char *input, int input_size, int output_size, decodesink_t sink, void *context);
+bool DecodeJaguarStream(const unsigned char *input, int input_size, int output_size, decodesink_t sink, void *context);
+
+typedef enum
+{
+    ENCODE_FAST = WADUTIL64_LEVEL_FAST,
+    ENCODE_MAX  = WADUTIL64_LEVEL_MAX
+} encodelevel;
+
+// Both encode into output and return the encoded size, or -1 once it would be larger than capacity,
+// and stop encoding early then. With a NULL output they only count the size.
+// They throw std::bad_alloc when out of memory.
+int Deflate_Encode(const byte *input, int size, int level, byte *output, int capacity);
+int EncodeJaguar(const byte *input, int size, int level, byte *output, int capacity);
+
+// Bump whenever an encoder's output changes, so cached lumps get compressed again
+#define ENCODER_VERSION 2
+
+typedef struct
+{
+    unsigned long long  hash;       // of the uncompressed lump
+    int                 size;       // uncompressed size
+    int                 codec;      // decodetype the lump is compressed for
+    int                 level;      // encodelevel it is compressed with
+} lumpkey_t;
+
+unsigned long long hash_data(const byte* data, size_t size);
+bool cache_open(const char* cache_dir);
+bool cache_load(const char* cache_dir, const lumpkey_t* key, std::vector<byte>* compressed);
+void cache_store(const char* cache_dir, const lumpkey_t* key, const std::vector<byte>* compressed);
+// What --stats records of a lump, times are in seconds
+typedef struct
+{
+    const char* file_name;
+    const char* mode;           // "decompress" or "compress"
+    char        name[9];
+    int         codec;          // decodetype chosen by choose_decode_mode
+    bool        stored;         // copied as it is, without the codec
+    int         input_size;
+    int         output_size;
+    double      read_seconds;   // getting the input bytes, a cache lookup when compressing
+    double      code_seconds;   // decoding or encoding, and choosing whether to keep the result
+    double      verify_seconds; // decoding the compressed lump again for --verify
+    double      write_seconds;  // putting the output in place, in the cache when compressing
+} lumpstats_t;
+
+typedef struct
+{
+    const char* file_name;
+    double      seconds;        // all modes, from opening the input to closing the output
+    double      write_seconds;  // writing the output file
+} filestats_t;
+
+typedef struct
+{
+    std::mutex                  lock;
+    std::vector<lumpstats_t>    lumps;
+    std::vector<filestats_t>    files;
+} statsreport_t;
+
+// Returns 0 without reading the clock when no stats are kept
+double stats_clock(const void* stats);
+void stats_add_lumps(statsreport_t* report, const std::vector<lumpstats_t>* lumps);
+void stats_add_file(statsreport_t* report, const filestats_t* file);
+void stats_print(const statsreport_t* report);
+bool stats_write_json(const statsreport_t* report, const char* json_file_name);
+
+// The decompressed lumps of one WAD, written by -d --sidecar=FILE and read
+// back in place by later single lump reads, so those don't decode again.
+// Lumps stored uncompressed in the WAD have no entry, they are read from it as they are.
+#define SIDECAR_VERSION 1
+
+typedef struct
+{
+    char                identification[4];  // LMPC
+    int                 version;            // SIDECAR_VERSION
+    int                 numlumps;           // of the source WAD
+    int                 numentries;
+    unsigned long long  directory_hash;     // of the source WAD's directory as stored
+} sidecarinfo_t;
+
+typedef struct
+{
+    unsigned long long  source_hash;        // of the compressed lump in the source WAD
+    char                name[8];            // without the compressed flag
+    int                 lump;               // index in the source WAD's directory
+    int                 source_pos;
+    int                 source_size;
+    int                 filepos;            // of the decompressed lump in the sidecar
+    int                 size;
+    int                 reserved;
+} sidecarlump_t;
+
+bool sidecar_write(const char* file_name, sidecarinfo_t* header, std::vector<sidecarlump_t>* lumps, const std::vector<const byte*>* lump_data);
+bool sidecar_open(const char* file_name, mappedfile_t* file, const sidecarinfo_t** header, const sidecarlump_t** lumps);
+
+// Estimated N64 cost of loading a lump, from the counts of ProfileD64 or ProfileJaguar
+double decode_cycles(const decodecounts_t* counts);
+double cycles_to_ms(double cycles);
+double rom_read_ms(int size);                               // reading size bytes off the cartridge
+double load_ms(const decodecounts_t* counts, int rom_size); // reading rom_size bytes and decoding them
+
+#endif